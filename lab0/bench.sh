@@ -0,0 +1,31 @@
+#!/bin/sh
+# Compare the cost of a read of /proc/count when the module reads the
+# kernel's task count (the default) and when it walks the task list
+# (walk=1), over $BENCH_READS reads each.  The module must be loaded, and
+# switching modes uses sudo.
+
+set -e
+
+reads=${BENCH_READS:-100000}
+param=/sys/module/proc_count/parameters/walk
+old=$(cat "$param")
+trap 'echo "$old" | sudo tee "$param" > /dev/null' EXIT
+
+printf '%-5s  %8s  %10s  %10s\n' Walk Count Reads ns/read
+for walk in N Y; do
+    echo "$walk" | sudo tee "$param" > /dev/null
+    python3 - "$walk" "$reads" <<'PY'
+import os
+import sys
+import time
+
+walk, reads = sys.argv[1], int(sys.argv[2])
+fd = os.open('/proc/count', os.O_RDONLY)
+start = time.perf_counter_ns()
+for _ in range(reads):
+    count = os.pread(fd, 64, 0)
+elapsed = time.perf_counter_ns() - start
+os.close(fd)
+print(f'{walk:<5}  {int(count):8}  {reads:10}  {elapsed / reads:10.0f}')
+PY
+done
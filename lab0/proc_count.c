@@ -1,35 +1,671 @@
+#include <linux/atomic.h>
+#include <linux/cgroup.h>
+#include <linux/cpumask.h>
+#include <linux/fs.h>
+#include <linux/gfp.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/nsproxy.h>
+#include <linux/overflow.h>
+#include <linux/pid_namespace.h>
+#include <linux/poll.h>
 #include <linux/printk.h>
 #include <linux/proc_fs.h>
+#include <linux/rcupdate.h>
 #include <linux/seq_file.h>
 #include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
-static struct proc_dir_entry *entry;
+#include "proc_count.h"
 
-static int proc_count(struct seq_file *m, void *v){
-	// TODO: it's all yours
-	
+static struct proc_dir_entry *entry, *breakdown_entry, *cgroups_entry, *history_entry,
+	*page_entry;
+
+/*
+ * /proc/count counts the tasks in the reader's PID namespace, so a reader in
+ * a container sees its own.  By default it reads the number of tasks that the
+ * kernel already keeps, which costs the same however many there are.  Setting walk counts
+ * processes by walking the task list instead, which is what the count used
+ * to be but takes time in proportion to the number of tasks.
+ */
+static bool walk;
+module_param(walk, bool, 0644);
+MODULE_PARM_DESC(walk, "Count processes by walking the task list (default: read the task count)");
+
+/*
+ * Return the number of tasks in NS, threads included, from the count of PIDs
+ * in use that the PID allocator maintains.  Every task but the idle tasks has
+ * a PID in the namespace it was created in and in each one above it; so does
+ * a process group or session whose leader has exited while its members live
+ * on, which is rare.  nr_threads and nr_processes() would do as well for the
+ * initial namespace but are not exported to modules.
+ */
+static int count_tasks(struct pid_namespace *ns)
+{
+	return READ_ONCE(ns->pid_allocated) & ~PIDNS_ADDING;
+}
+
+/* Return the number of processes with a PID in NS */
+static int count_processes(struct pid_namespace *ns)
+{
 	struct task_struct *task;
 	int count = 0;
 
-	for_each_process(task){
-		count++;
+	rcu_read_lock();
+	for_each_process(task)
+		if (ns == &init_pid_ns || task_tgid_nr_ns(task, ns))
+			count++;
+	rcu_read_unlock();
+
+	return count;
+}
+
+/* Return the count that /proc/count shows in NS, as chosen by walk */
+static int count(struct pid_namespace *ns)
+{
+	return READ_ONCE(walk) ? count_processes(ns) : count_tasks(ns);
+}
+
+static int proc_count(struct seq_file *m, void *v)
+{
+	seq_printf(m, "%d\n", count(task_active_pid_ns(current)));
+	return 0;
+}
+
+/*
+ * A sampler records the count in the initial PID namespace every sample_ms
+ * milliseconds into a ring of the last HISTORY_SAMPLES samples, which
+ * /proc/count_history hands out: each read returns, one "TIME COUNT" line
+ * apiece, every sample since the one the reader last got, as many as fit,
+ * where TIME is in nanoseconds since the epoch.  A reader's file position is
+ * the number of the next sample it will get, so a new reader starts from the
+ * oldest sample kept, and one that falls more than HISTORY_SAMPLES behind
+ * skips to it.  A read blocks until there is a new sample unless the file is
+ * nonblocking, and poll() reports when there is one.
+ */
+#define HISTORY_SAMPLES 4096	/* A power of 2 */
+#define HISTORY_LINE 32
+
+struct sample {
+	u64 time;
+	int count;
+};
+
+static struct sample history[HISTORY_SAMPLES];
+static u64 history_head;	/* The number of samples ever taken */
+static DEFINE_SPINLOCK(history_lock);
+static DECLARE_WAIT_QUEUE_HEAD(history_wait);
+static bool history_closing;	/* Set when the module is going away */
+
+static void history_sample(struct work_struct *work);
+static void page_update(u64 time, int count);
+static DECLARE_DELAYED_WORK(history_work, history_sample);
+
+static unsigned int sample_ms = 1000;
+
+/*
+ * Apply a new period right away, rather than after the current one.  This is
+ * called with the module's parameter lock held, which proc_count_exit() takes
+ * to set history_closing, so the sampler cannot be restarted once it stops.
+ */
+static int set_sample_ms(const char *val, const struct kernel_param *kp)
+{
+	int err = param_set_uint(val, kp);
+
+	if (!err && history_entry && !history_closing)
+		mod_delayed_work(system_wq, &history_work, 0);
+	return err;
+}
+
+static const struct kernel_param_ops sample_ms_ops = {
+	.set = set_sample_ms,
+	.get = param_get_uint,
+};
+module_param_cb(sample_ms, &sample_ms_ops, &sample_ms, 0644);
+MODULE_PARM_DESC(sample_ms, "Milliseconds between samples in /proc/count_history, or 0 to stop");
+
+static void history_sample(struct work_struct *work)
+{
+	unsigned int period = READ_ONCE(sample_ms);
+	struct sample s;
+
+	if (!period)
+		return;
+
+	s.time = ktime_get_real_ns();
+	s.count = count(&init_pid_ns);
+	spin_lock(&history_lock);
+	history[history_head & (HISTORY_SAMPLES - 1)] = s;
+	history_head++;
+	spin_unlock(&history_lock);
+	wake_up_interruptible(&history_wait);
+	page_update(s.time, s.count);
+
+	schedule_delayed_work(&history_work, msecs_to_jiffies(period));
+}
+
+static u64 history_count(void)
+{
+	u64 head;
+
+	spin_lock(&history_lock);
+	head = history_head;
+	spin_unlock(&history_lock);
+	return head;
+}
+
+static ssize_t history_read(struct file *file, char __user *buf, size_t len,
+			    loff_t *ppos)
+{
+	u64 next = *ppos;
+	size_t done = 0;
+
+	if (file->f_flags & O_NONBLOCK) {
+		if (history_count() <= next && !READ_ONCE(history_closing))
+			return -EAGAIN;
+	} else if (wait_event_interruptible(history_wait,
+					    history_count() > next ||
+					    READ_ONCE(history_closing))) {
+		return -ERESTARTSYS;
 	}
 
-	seq_printf(m, "%d\n", count);
+	for (;;) {
+		char line[HISTORY_LINE];
+		struct sample s;
+		int n;
 
+		spin_lock(&history_lock);
+		if (next >= history_head) {
+			spin_unlock(&history_lock);
+			break;
+		}
+		if (history_head - next > HISTORY_SAMPLES)
+			next = history_head - HISTORY_SAMPLES;
+		s = history[next & (HISTORY_SAMPLES - 1)];
+		spin_unlock(&history_lock);
+
+		n = scnprintf(line, sizeof(line), "%llu %d\n", s.time, s.count);
+		if (n > len - done) {
+			if (!done)
+				return -EINVAL;
+			break;
+		}
+		if (copy_to_user(buf + done, line, n))
+			return done ? done : -EFAULT;
+		done += n;
+		next++;
+	}
+
+	*ppos = next;
+	return done;
+}
+
+static __poll_t history_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &history_wait, wait);
+	if (history_count() > file->f_pos || READ_ONCE(history_closing))
+		return EPOLLIN | EPOLLRDNORM;
 	return 0;
 }
 
+static const struct proc_ops history_ops = {
+	.proc_read = history_read,
+	.proc_poll = history_poll,
+	.proc_lseek = default_llseek,
+};
+
+/* The task states as reported in /proc/PID/stat, in task_state_index() order */
+static const char *const state_names[] = {
+	"running",		/* R */
+	"sleeping",		/* S */
+	"uninterruptible",	/* D */
+	"stopped",		/* T */
+	"traced",		/* t */
+	"dead",			/* X */
+	"zombie",		/* Z */
+	"parked",		/* P */
+	"idle",			/* I */
+};
+
+/*
+ * A snapshot of the tasks for /proc/count_breakdown, taken in one pass over
+ * the task list when a read starts.  It holds a count for each state and,
+ * for each CPU, the number of running tasks last placed on it.
+ */
+struct breakdown {
+	int tasks;
+	int processes;
+	int states[ARRAY_SIZE(state_names)];
+	int running[];		/* nr_cpu_ids of them */
+};
+
+static void breakdown_fill(struct breakdown *b)
+{
+	struct task_struct *p, *t;
+
+	memset(b, 0, struct_size(b, running, nr_cpu_ids));
+
+	rcu_read_lock();
+	for_each_process_thread(p, t) {
+		unsigned int state = task_state_index(t);
+
+		b->tasks++;
+		if (thread_group_leader(t))
+			b->processes++;
+		b->states[state]++;
+		if (state == 0)
+			b->running[task_cpu(t)]++;
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * The records of /proc/count_breakdown are the two totals, then the states,
+ * then the possible CPUs, numbered in that order from 0 up to BREAKDOWN_END.
+ */
+#define BREAKDOWN_TOTALS 2
+#define BREAKDOWN_CPUS (BREAKDOWN_TOTALS + ARRAY_SIZE(state_names))
+#define BREAKDOWN_END (BREAKDOWN_CPUS + nr_cpu_ids)
+
+/* Return the number of the first record at or after POS. */
+static loff_t breakdown_record(loff_t pos)
+{
+	unsigned int cpu;
+
+	if (pos < BREAKDOWN_CPUS)
+		return pos;
+	if (pos >= BREAKDOWN_END)
+		return BREAKDOWN_END;
+	cpu = pos - BREAKDOWN_CPUS;
+	if (!cpu_possible(cpu))
+		cpu = min_t(unsigned int, cpumask_next(cpu, cpu_possible_mask), nr_cpu_ids);
+	return BREAKDOWN_CPUS + cpu;
+}
+
+static void *breakdown_start(struct seq_file *m, loff_t *pos)
+{
+	struct breakdown *b = m->private;
+
+	/* A read that carries on where the last one stopped keeps its snapshot */
+	if (*pos == 0)
+		breakdown_fill(b);
+	*pos = breakdown_record(*pos);
+	return *pos < BREAKDOWN_END ? b : NULL;
+}
+
+static void *breakdown_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	*pos = breakdown_record(*pos + 1);
+	return *pos < BREAKDOWN_END ? v : NULL;
+}
+
+static void breakdown_stop(struct seq_file *m, void *v)
+{
+}
+
+static int breakdown_show(struct seq_file *m, void *v)
+{
+	struct breakdown *b = v;
+	int pos = m->index;
+
+	if (pos == 0)
+		seq_printf(m, "tasks %d\n", b->tasks);
+	else if (pos == 1)
+		seq_printf(m, "processes %d\n", b->processes);
+	else if (pos < BREAKDOWN_CPUS)
+		seq_printf(m, "%s %d\n", state_names[pos - BREAKDOWN_TOTALS],
+			   b->states[pos - BREAKDOWN_TOTALS]);
+	else
+		seq_printf(m, "cpu%d %d\n", pos - (int)BREAKDOWN_CPUS,
+			   b->running[pos - BREAKDOWN_CPUS]);
+	return 0;
+}
+
+static const struct seq_operations breakdown_ops = {
+	.start = breakdown_start,
+	.next = breakdown_next,
+	.stop = breakdown_stop,
+	.show = breakdown_show,
+};
+
+/*
+ * /proc/count_page maps stats_page, a struct count_page (see proc_count.h)
+ * that the sampler rewrites with each sample under a sequence count, so that
+ * a reader polling it makes no system calls at all.  The breakdown on it
+ * takes a walk of the task list, which the sampler only does while the page
+ * is mapped somewhere; each mapping holds a reference to the module, which
+ * keeps the mapping's close from outliving the code it calls.
+ */
+static struct page *stats_page;
+static struct breakdown *page_breakdown;
+static atomic_t page_maps;	/* The number of mappings of stats_page */
+
+/* Only the sampler calls this, so there is only ever one writer. */
+static void page_update(u64 time, int count)
+{
+	struct count_page *p = page_address(stats_page);
+	struct breakdown *b = page_breakdown;
+	int i;
+
+	/* Walk the tasks first to keep the window readers retry in short */
+	if (atomic_read(&page_maps))
+		breakdown_fill(b);
+
+	WRITE_ONCE(p->seq, p->seq + 1);
+	smp_wmb();
+	p->count = count;
+	p->time = time;
+	p->tasks = b->tasks;
+	p->processes = b->processes;
+	for (i = 0; i < COUNT_PAGE_STATES; i++)
+		p->states[i] = b->states[i];
+	smp_wmb();
+	WRITE_ONCE(p->seq, p->seq + 1);
+}
+
+/*
+ * Called for each copy of a mapping made by fork() or split off, whose
+ * original already holds a reference to the module
+ */
+static void page_vm_open(struct vm_area_struct *vma)
+{
+	__module_get(THIS_MODULE);
+	atomic_inc(&page_maps);
+}
+
+static void page_vm_close(struct vm_area_struct *vma)
+{
+	atomic_dec(&page_maps);
+	module_put(THIS_MODULE);
+}
+
+static const struct vm_operations_struct page_vm_ops = {
+	.open = page_vm_open,
+	.close = page_vm_close,
+};
+
+static int page_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	int err;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	/* An mmap() racing the module's unload must not pin it */
+	if (!try_module_get(THIS_MODULE))
+		return -ENODEV;
+	err = vm_insert_page(vma, vma->vm_start, stats_page);
+	if (err) {
+		module_put(THIS_MODULE);
+		return err;
+	}
+
+	vma->vm_ops = &page_vm_ops;
+	atomic_inc(&page_maps);
+	/* Take a sample now rather than leave the first mapping a stale breakdown */
+	if (atomic_read(&page_maps) == 1 && READ_ONCE(sample_ms))
+		mod_delayed_work(system_wq, &history_work, 0);
+	return 0;
+}
+
+static const struct proc_ops page_ops = {
+	.proc_mmap = page_mmap,
+};
+
+/*
+ * /proc/count_cgroups gives, for every cgroup in the reader's cgroup namespace
+ * with tasks in it or below it, the number of those tasks, one "PATH TASKS"
+ * line apiece, from one pass over the task list when a read starts.  The pass
+ * notes the cgroup of each task; sorting the notes and merging those of the
+ * same cgroup gives the tasks in each, and adding each cgroup's tasks to those
+ * of its ancestors and merging again gives the totals.  That is all done under
+ * RCU, which keeps the cgroups from being freed until each has a reference.
+ */
+struct cgroup_count {
+	struct cgroup *cgrp;
+	int tasks;
+};
+
+struct cgroup_snapshot {
+	struct cgroup_count *counts;	/* In order of cgroup ID, parents first */
+	size_t n;
+	char path[PATH_MAX];
+};
+
+static int cgroup_count_cmp(const void *a, const void *b)
+{
+	u64 x = cgroup_id(((const struct cgroup_count *)a)->cgrp);
+	u64 y = cgroup_id(((const struct cgroup_count *)b)->cgrp);
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sort C[0..N) by cgroup and merge the counts of each, returning how many remain */
+static size_t cgroup_counts_merge(struct cgroup_count *c, size_t n)
+{
+	size_t i, m = 0;
+
+	sort(c, n, sizeof(*c), cgroup_count_cmp, NULL);
+	for (i = 0; i < n; i++) {
+		if (m && c[m - 1].cgrp == c[i].cgrp)
+			c[m - 1].tasks += c[i].tasks;
+		else
+			c[m++] = c[i];
+	}
+	return m;
+}
+
+static void cgroup_snapshot_put(struct cgroup_snapshot *snap)
+{
+	size_t i;
+
+	for (i = 0; i < snap->n; i++)
+		if (snap->counts[i].cgrp)
+			css_put(&snap->counts[i].cgrp->self);
+	kvfree(snap->counts);
+	snap->counts = NULL;
+	snap->n = 0;
+}
+
+static int cgroup_snapshot_fill(struct cgroup_snapshot *snap)
+{
+	size_t cap = count_tasks(&init_pid_ns) + 64;
+
+	for (;;) {
+		struct cgroup_count *c = kvmalloc_array(cap, sizeof(*c), GFP_KERNEL);
+		struct task_struct *p, *t;
+		struct cgroup *root;
+		size_t i, n = 0, m, need;
+
+		if (!c)
+			return -ENOMEM;
+
+		rcu_read_lock();
+		root = current->nsproxy->cgroup_ns->root_cset->dfl_cgrp;
+		for_each_process_thread(p, t) {
+			struct cgroup *cgrp = task_dfl_cgroup(t);
+
+			if (!cgroup_is_descendant(cgrp, root))
+				continue;
+			if (n == cap)
+				goto grow;
+			c[n++] = (struct cgroup_count){ cgrp, 1 };
+		}
+
+		m = cgroup_counts_merge(c, n);
+		for (i = 0, need = m; i < m; i++)
+			need += c[i].cgrp->level - root->level;
+		if (need > cap) {
+			cap = need;
+			goto grow;
+		}
+
+		n = m;
+		for (i = 0; i < m; i++) {
+			struct cgroup *cgrp = c[i].cgrp;
+
+			while (cgrp != root) {
+				cgrp = cgroup_parent(cgrp);
+				c[n++] = (struct cgroup_count){ cgrp, c[i].tasks };
+			}
+		}
+		n = cgroup_counts_merge(c, n);
+
+		/* A cgroup already on its way out is left out */
+		for (i = 0; i < n; i++)
+			if (!css_tryget(&c[i].cgrp->self))
+				c[i].cgrp = NULL;
+		rcu_read_unlock();
+
+		snap->counts = c;
+		snap->n = n;
+		return 0;
+
+grow:
+		/* Tasks came faster than the slack allowed for */
+		rcu_read_unlock();
+		kvfree(c);
+		cap = max(cap, 2 * n);
+	}
+}
+
+static void *cgroups_start(struct seq_file *m, loff_t *pos)
+{
+	struct cgroup_snapshot *snap = m->private;
+
+	/* As with /proc/count_breakdown, a read that carries on keeps its snapshot */
+	if (*pos == 0) {
+		int err;
+
+		cgroup_snapshot_put(snap);
+		err = cgroup_snapshot_fill(snap);
+		if (err)
+			return ERR_PTR(err);
+	}
+	return *pos < snap->n ? &snap->counts[*pos] : NULL;
+}
+
+static void *cgroups_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct cgroup_snapshot *snap = m->private;
+
+	++*pos;
+	return *pos < snap->n ? &snap->counts[*pos] : NULL;
+}
+
+static void cgroups_stop(struct seq_file *m, void *v)
+{
+}
+
+static int cgroups_show(struct seq_file *m, void *v)
+{
+	struct cgroup_snapshot *snap = m->private;
+	struct cgroup_count *c = v;
+
+	if (!c->cgrp ||
+	    cgroup_path_ns(c->cgrp, snap->path, sizeof(snap->path),
+			   current->nsproxy->cgroup_ns) < 0)
+		return SEQ_SKIP;
+	seq_printf(m, "%s %d\n", snap->path, c->tasks);
+	return 0;
+}
+
+static const struct seq_operations cgroups_seq_ops = {
+	.start = cgroups_start,
+	.next = cgroups_next,
+	.stop = cgroups_stop,
+	.show = cgroups_show,
+};
+
+static int cgroups_open(struct inode *inode, struct file *file)
+{
+	return seq_open_private(file, &cgroups_seq_ops,
+				sizeof(struct cgroup_snapshot));
+}
+
+static int cgroups_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+
+	cgroup_snapshot_put(m->private);
+	return seq_release_private(inode, file);
+}
+
+static const struct proc_ops cgroups_ops = {
+	.proc_open = cgroups_open,
+	.proc_read = seq_read,
+	.proc_lseek = seq_lseek,
+	.proc_release = cgroups_release,
+};
+
 static int __init proc_count_init(void)
 {
+	BUILD_BUG_ON(1 + ilog2(TASK_REPORT_MAX) != ARRAY_SIZE(state_names));
+	BUILD_BUG_ON(COUNT_PAGE_STATES != ARRAY_SIZE(state_names));
+	BUILD_BUG_ON(sizeof(struct count_page) > PAGE_SIZE);
+
+	stats_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	page_breakdown = kmalloc(struct_size(page_breakdown, running, nr_cpu_ids),
+				 GFP_KERNEL);
+	if (!stats_page || !page_breakdown) {
+		if (stats_page)
+			__free_page(stats_page);
+		kfree(page_breakdown);
+		return -ENOMEM;
+	}
+
 	entry = proc_create_single("count", 0, NULL, proc_count);
+	breakdown_entry = proc_create_seq_private("count_breakdown", 0, NULL,
+						  &breakdown_ops,
+						  struct_size((struct breakdown *)NULL,
+							      running, nr_cpu_ids),
+						  NULL);
+	cgroups_entry = proc_create("count_cgroups", 0, NULL, &cgroups_ops);
+	history_entry = proc_create("count_history", 0, NULL, &history_ops);
+	page_entry = proc_create("count_page", 0, NULL, &page_ops);
+	schedule_delayed_work(&history_work, 0);
 	pr_info("proc_count: init\n");
 	return 0;
 }
 
 static void __exit proc_count_exit(void)
 {
+	/* Wake blocked readers, or removing the entry would wait for them */
+	kernel_param_lock(THIS_MODULE);
+	WRITE_ONCE(history_closing, true);
+	kernel_param_unlock(THIS_MODULE);
+	wake_up_interruptible_all(&history_wait);
+	proc_remove(history_entry);
+	/*
+	 * Every mapping holds a reference to the module, so none is left, and
+	 * an mmap() still in progress cannot take one, so it queues no sample;
+	 * removing the entry waits for it to finish.
+	 */
+	proc_remove(page_entry);
+	cancel_delayed_work_sync(&history_work);
+
+	__free_page(stats_page);
+	kfree(page_breakdown);
+
+	proc_remove(cgroups_entry);
+	proc_remove(breakdown_entry);
 	proc_remove(entry);
 	pr_info("proc_count: exit\n");
 }
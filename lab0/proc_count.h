@@ -0,0 +1,35 @@
+#ifndef PROC_COUNT_H
+#define PROC_COUNT_H
+
+#include <linux/types.h>
+
+/*
+ * The layout of /proc/count_page, a read-only page that user space maps to
+ * read the latest sample without a system call per read.  The sampler
+ * behind /proc/count_history rewrites it every sample_ms milliseconds.
+ *
+ * seq is odd while the page is being rewritten and goes up by 2 with each
+ * sample, so a consistent snapshot is one read between two equal, even loads
+ * of seq:
+ *
+ *	do {
+ *		while ((seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE)) & 1)
+ *			;
+ *		snapshot = *page;
+ *		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *	} while (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+ *
+ * seq is 0 until the first sample.
+ */
+#define COUNT_PAGE_STATES 9	/* The states of /proc/count_breakdown, in order */
+
+struct count_page {
+	__u32 seq;
+	__s32 count;		/* As /proc/count showed at the time */
+	__u64 time;		/* Nanoseconds since the epoch */
+	__s32 tasks;
+	__s32 processes;
+	__s32 states[COUNT_PAGE_STATES];
+};
+
+#endif
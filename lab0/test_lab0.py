@@ -1,6 +1,11 @@
+import mmap
+import os
 import pathlib
 import re
+import select
+import struct
 import subprocess
+import time
 import unittest
 
 class TestLab0(unittest.TestCase):
@@ -21,6 +26,14 @@ class TestLab0(unittest.TestCase):
                                 capture_output=True, text=True)
         return result
 
+    def _set_walk(value):
+        subprocess.run(['sudo', 'tee', '/sys/module/proc_count/parameters/walk'],
+                       input=value, capture_output=True, text=True)
+
+    def _set_sample_ms(value):
+        subprocess.run(['sudo', 'tee', '/sys/module/proc_count/parameters/sample_ms'],
+                       input=value, capture_output=True, text=True)
+
     def _make_clean():
         result = subprocess.run(['make', 'clean'],
                                 capture_output=True, text=True)
@@ -63,8 +76,135 @@ class TestLab0(unittest.TestCase):
         self.assertTrue(self.make, msg='make failed')
         self.assertTrue(self.insmod, msg='insmod failed')
 
-        result = subprocess.run('ps aux | wc -l',
+        # PIDs kept by process groups or sessions whose leaders have
+        # exited count too, so allow for a few of those
+        result = subprocess.run('ps -eLf | wc -l',
                                 capture_output=True, shell=True, text=True)
         with open(self.PATH, 'r') as f:
-            self.assertEqual(int(result.stdout), int(f.read()) + 4,
-                             msg='number of processes did not match')
+            self.assertAlmostEqual(int(result.stdout), int(f.read()) + 4, delta=4,
+                                   msg='number of tasks did not match')
+
+    def test_count_walk(self):
+        self.assertTrue(self.make, msg='make failed')
+        self.assertTrue(self.insmod, msg='insmod failed')
+
+        TestLab0._set_walk('Y')
+        try:
+            result = subprocess.run('ps aux | wc -l',
+                                    capture_output=True, shell=True, text=True)
+            with open(self.PATH, 'r') as f:
+                self.assertEqual(int(result.stdout), int(f.read()) + 4,
+                                 msg='number of processes did not match')
+        finally:
+            TestLab0._set_walk('N')
+
+    def test_breakdown(self):
+        self.assertTrue(self.make, msg='make failed')
+        self.assertTrue(self.insmod, msg='insmod failed')
+
+        with open('/proc/count_breakdown', 'r') as f:
+            records = {}
+            for line in f.read().splitlines():
+                m = re.match(r'^(\w+) (\d+)$', line, flags=re.ASCII)
+                self.assertIsNotNone(m, msg=f'bad line {line!r}')
+                records[m[1]] = int(m[2])
+
+        states = ('running', 'sleeping', 'uninterruptible', 'stopped',
+                  'traced', 'dead', 'zombie', 'parked', 'idle')
+        cpus = [name for name in records if re.match(r'^cpu\d+$', name)]
+        self.assertEqual(sum(records[s] for s in states), records['tasks'],
+                         msg='the states should add up to the tasks')
+        self.assertEqual(sum(records[c] for c in cpus), records['running'],
+                         msg='the CPUs should add up to the running tasks')
+        self.assertGreaterEqual(records['running'], 1,
+                                msg='the reader itself is running')
+
+    def test_history(self):
+        self.assertTrue(self.make, msg='make failed')
+        self.assertTrue(self.insmod, msg='insmod failed')
+
+        TestLab0._set_sample_ms('50')
+        fd = os.open('/proc/count_history', os.O_RDONLY | os.O_NONBLOCK)
+        try:
+            # Catch up, then wait for the sampler to add more
+            self.assertTrue(select.select([fd], [], [], 1)[0],
+                            msg='poll should report samples')
+            lines = os.read(fd, 65536).decode().splitlines()
+            self.assertGreater(len(lines), 0, msg='there should be samples')
+            while True:
+                try:
+                    os.read(fd, 65536)
+                except BlockingIOError:
+                    break
+            self.assertTrue(select.select([fd], [], [], 1)[0],
+                            msg='poll should report a new sample')
+            lines = os.read(fd, 65536).decode().splitlines()
+            self.assertGreater(len(lines), 0, msg='there should be a new sample')
+            for line in lines:
+                self.assertIsNotNone(re.match(r'^\d+ \d+$', line, flags=re.ASCII),
+                                     msg=f'bad sample {line!r}')
+        finally:
+            os.close(fd)
+            TestLab0._set_sample_ms('1000')
+
+    def test_page(self):
+        self.assertTrue(self.make, msg='make failed')
+        self.assertTrue(self.insmod, msg='insmod failed')
+
+        # struct count_page in proc_count.h
+        layout = struct.Struct('=IiQii9i')
+        with open('/proc/count_page', 'rb') as f:
+            page = mmap.mmap(f.fileno(), mmap.PAGESIZE, prot=mmap.PROT_READ)
+        try:
+            with self.assertRaises(TypeError, msg='the page should be read-only'):
+                page[0] = 0
+            deadline = time.monotonic() + 3
+            while True:
+                seq, count, stamp, tasks, processes, *states = \
+                    layout.unpack_from(page)
+                # The breakdown is only filled in once the page is mapped
+                if tasks and seq % 2 == 0 and \
+                   struct.unpack_from('=I', page)[0] == seq:
+                    break
+                self.assertLess(time.monotonic(), deadline,
+                                msg='the page should get a sample')
+                time.sleep(0.01)
+            self.assertGreater(count, 0)
+            self.assertLessEqual(processes, tasks)
+            self.assertEqual(sum(states), tasks,
+                             msg='the states should add up to the tasks')
+            self.assertAlmostEqual(stamp / 1e9, time.time(), delta=5)
+        finally:
+            page.close()
+
+    def test_namespace(self):
+        self.assertTrue(self.make, msg='make failed')
+        self.assertTrue(self.insmod, msg='insmod failed')
+
+        result = subprocess.run(['sudo', 'unshare', '--pid', '--fork', '--mount-proc',
+                                 'cat', str(self.PATH)],
+                                capture_output=True, text=True)
+        self.assertEqual(result.returncode, 0, msg=result.stderr)
+        self.assertEqual(int(result.stdout), 1,
+                         msg='a new PID namespace should hold only the reader')
+
+    def test_cgroups(self):
+        self.assertTrue(self.make, msg='make failed')
+        self.assertTrue(self.insmod, msg='insmod failed')
+
+        counts = {}
+        for line in pathlib.Path('/proc/count_cgroups').read_text().splitlines():
+            path, tasks = line.rsplit(' ', 1)
+            counts[path] = int(tasks)
+        self.assertIn('/', counts, msg='the root should be listed')
+        self.assertAlmostEqual(counts['/'], int(self.PATH.read_text()), delta=4)
+
+        own = pathlib.Path('/proc/self/cgroup').read_text()
+        own = re.search(r'^0::(.*)$', own, flags=re.MULTILINE).group(1)
+        self.assertGreaterEqual(counts.get(own, 0), 1,
+                                msg=f'the reader\'s cgroup {own} should be listed')
+        for path, tasks in counts.items():
+            if path != '/':
+                parent = path.rsplit('/', 1)[0] or '/'
+                self.assertGreaterEqual(counts.get(parent, 0), tasks,
+                                        msg=f'{parent} should include {path}')
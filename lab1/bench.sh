@@ -0,0 +1,81 @@
+#!/bin/sh
+# Compare pipe with sh -c 'a | b | ...' on pipelines of each length in
+# $BENCH_STAGES made of each command in $BENCH_CMDS, fed each input size
+# in $BENCH_SIZES (as for head -c, so 1M or 10G).  Startup is the time
+# to run the pipeline on empty input, and the throughput is that of
+# pushing the input through it.  If strace is installed, the system
+# calls of each run are counted in a separate run, so that tracing does
+# not slow the timed one.
+
+set -e
+
+stages=${BENCH_STAGES:-"1 10 100 1000"}
+cmds=${BENCH_CMDS:-"cat /bin/cat"}
+sizes=${BENCH_SIZES:-"1M 100M"}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+trace=
+
+line=0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-
+
+# Print the word $1 $2 times, separated by $3
+repeat() {
+    awk -v w="$1" -v n="$2" -v sep="$3" \
+        'BEGIN { for (i = 0; i < n; i++) printf "%s%s", i ? sep : "", w; print "" }'
+}
+
+# Run $2 stages of the command $3 with the runner $1, pipe or sh, under
+# the command in $trace if it is set
+run() {
+    if [ "$1" = pipe ]; then
+        $trace ./pipe $(repeat "$3" "$2" " ")
+    else
+        $trace sh -c "$(repeat "$3" "$2" " | ")"
+    fi
+}
+
+# Feed $1 bytes of lines to the rest of the arguments, run as for run
+feed() {
+    size=$1
+    shift
+    yes "$line" | head -c "$size" | "$@" > /dev/null
+}
+
+printf '%6s  %-8s  %-6s  %6s  %9s  %9s  %9s  %10s\n' \
+    Stages Command Runner Input Startup Seconds MB/s Syscalls
+for n in $stages; do
+    for cmd in $cmds; do
+        for runner in pipe sh; do
+            start=$(date +%s.%N)
+            run "$runner" "$n" "$cmd" < /dev/null > /dev/null
+            end=$(date +%s.%N)
+            startup=$(awk -v start="$start" -v end="$end" 'BEGIN { print end - start }')
+
+            for size in $sizes; do
+                start=$(date +%s.%N)
+                feed "$size" run "$runner" "$n" "$cmd"
+                end=$(date +%s.%N)
+
+                calls=-
+                if command -v strace > /dev/null; then
+                    trace="strace -f -c -o $dir/strace"
+                    feed "$size" run "$runner" "$n" "$cmd"
+                    trace=
+                    calls=$(awk '$NF == "total" { print $4 }' "$dir/strace")
+                fi
+
+                awk -v n="$n" -v c="$cmd" -v r="$runner" -v size="$size" \
+                    -v startup="$startup" -v start="$start" -v end="$end" -v calls="$calls" \
+                    'BEGIN {
+                        bytes = size + 0
+                        unit = substr(size, length(size))
+                        if (unit == "K") bytes *= 1024
+                        else if (unit == "M") bytes *= 1024 * 1024
+                        else if (unit == "G") bytes *= 1024 * 1024 * 1024
+                        printf "%6s  %-8s  %-6s  %6s  %9.3f  %9.3f  %9.1f  %10s\n", n, c, r,
+                               size, startup, end - start, bytes / (end - start) / 1e6, calls
+                    }'
+            done
+        done
+    done
+done
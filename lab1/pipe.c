@@ -1,94 +1,1015 @@
+#define _GNU_SOURCE
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <errno.h>
 
-int main(int argc, char *argv[])
+/* Capacity of each pipe in relay mode, unless -b says otherwise.  */
+#define RELAY_PIPE_SIZE (1 << 20)
+
+/* Size of the buffers a parallel stage's distributor and merger use to
+   find line boundaries.  */
+#define LINE_BUFFER (1 << 16)
+
+/* Capacity to give each pipe with F_SETPIPE_SZ, or 0 to keep the default.  */
+static int pipe_size;
+
+/* An eventfd that is written each time a child exits or a builtin thread
+   ends, to wake the launcher waiting for the pipeline.  */
+static int wake_fd = -1;
+
+/* A filter that is run as a thread in the launcher instead of as a
+   process, when a command is given by its bare name.  RUN copies from IN
+   to OUT and returns 0, or an error number if it fails.  */
+struct builtin
 {
-    int fds[argc - 1][2];
-    pid_t cpid[argc - 1];
-    int st;
+    const char *name;
+    int (*run)(int in, int out);
+};
+
+/* A process in the pipeline and what became of it.  A stage run as
+   several parallel workers has one of these per worker, followed by one
+   each for its distributor and merger, and in relay mode the relay from
+   a command to the next one follows it.  */
+struct stage
+{
+    char *cmd;
+    int index;       /* Position of the command in the pipeline */
+    int worker;      /* Which of the stage's NWORKERS workers this is */
+    int nworkers;
+    bool helper;     /* A relay, distributor or merger, not a command */
+    const struct builtin *builtin;  /* If run as a thread, how */
+    pthread_t thread;
+    int in, out;     /* The builtin's own copies of its input and output */
+    atomic_bool ended;  /* Whether the builtin's thread has finished */
+    pid_t pid;
+    int spawn_err;   /* Error number if it could not be run, or 0 */
+    bool done;       /* Whether it has been reaped */
+    int status;      /* Wait status once it has been reaped */
+    struct timespec start, end;
+    struct rusage usage;
+};
+
+static double seconds_between(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
 
-    if (argc < 2)
+/* Create a pipe whose ends are closed on exec, so that each command
+   only keeps the ends it is given as its standard input and output.  */
+static void make_pipe(int fds[2])
+{
+    if (pipe2(fds, O_CLOEXEC) == -1)
     {
-        exit(EINVAL);
+        perror("Error in Creating Pipe");
+        exit(errno);
+    }
+    if (pipe_size && fcntl(fds[1], F_SETPIPE_SZ, pipe_size) < 0)
+    {
+        perror("Error in Setting Pipe Size");
+        exit(errno);
+    }
+}
+
+/* Move everything from the pipe IN to the pipe OUT with splice, so that
+   the data is never copied through user space, then report on stderr
+   how much went over the link from command FROM to command TO and how
+   fast.  */
+static void relay(int in, int out, const char *from, const char *to)
+{
+    struct timespec start, end;
+    long long total = 0;
+
+    int capacity = fcntl(out, F_GETPIPE_SZ);
+    if (capacity < 0)
+    {
+        perror("Error in Getting Pipe Size");
+        exit(errno);
     }
 
-    for (int i = 0; i < argc - 1; i++)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
     {
-        if (pipe(fds[i]) == -1)
+        ssize_t n = splice(in, NULL, out, NULL, capacity, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0)
         {
-            perror("Error in Creating Pipe");
+            if (errno == EINTR)
+                continue;
+            perror("Error in splice");
             exit(errno);
         }
+        if (n == 0)
+            break;
+        total += n;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = seconds_between(&start, &end);
+    fprintf(stderr, "%s -> %s: %lld bytes in %.3f s (%.1f MB/s)\n", from, to, total,
+            seconds, seconds > 0 ? total / seconds / 1e6 : 0.0);
+    exit(EXIT_SUCCESS);
+}
+
+/* Write all LEN bytes of BUF to FD.  Return 0, or -1 with errno set if
+   a write fails.  */
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int compare_ints(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/* Close every descriptor above standard error but the NKEEP in KEEP.  A
+   helper forked without exec calls this first, so that it holds no pipe
+   end that another process, or a builtin thread that it did not inherit,
+   is waiting to see closed.  */
+static void close_all_but(const int *keep, int nkeep)
+{
+    int *sorted = malloc(nkeep * sizeof *sorted);
+    if (!sorted)
+    {
+        perror("Error in malloc");
+        exit(errno);
+    }
+    memcpy(sorted, keep, nkeep * sizeof *sorted);
+    qsort(sorted, nkeep, sizeof *sorted, compare_ints);
+
+    unsigned int from = STDERR_FILENO + 1;
+    for (int i = 0; i < nkeep; i++)
+    {
+        if (sorted[i] < (int)from)
+            continue;
+        if (sorted[i] > (int)from)
+            close_range(from, sorted[i] - 1, 0);
+        from = sorted[i] + 1;
+    }
+    close_range(from, ~0U, 0);
+    free(sorted);
+}
+
+/* Deal the lines read from IN out to the NWORKERS pipes in OUTS round
+   robin.  Each read goes to one worker, cut back to its last newline so
+   that no line is split between workers; a line longer than the buffer
+   keeps going to the same worker until it ends.  A worker that exits
+   early is dropped from the rotation.  */
+static void distribute(int in, int *outs, int nworkers)
+{
+    char *buf = malloc(LINE_BUFFER);
+    if (!buf)
+    {
+        perror("Error in malloc");
+        exit(errno);
+    }
+    // A worker that has exited shows up as EPIPE rather than a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t len = 0;
+    int k = 0;
+    int live = nworkers;
+    bool eof = false;
+    while (!eof || len > 0)
+    {
+        if (!eof)
+        {
+            ssize_t n = read(in, buf + len, LINE_BUFFER - len);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("Error in read");
+                exit(errno);
+            }
+            eof = n == 0;
+            len += n;
+        }
+
+        char *nl = memrchr(buf, '\n', len);
+        size_t send = nl ? (size_t)(nl - buf + 1) : eof || len == LINE_BUFFER ? len : 0;
+        if (send == 0)
+            continue;
+        while (write_all(outs[k], buf, send) < 0)
+        {
+            if (errno != EPIPE)
+            {
+                perror("Error in write");
+                exit(errno);
+            }
+            close(outs[k]);
+            outs[k] = -1;
+            if (--live == 0)
+                exit(EXIT_SUCCESS);
+            do
+                k = (k + 1) % nworkers;
+            while (outs[k] < 0);
+        }
+        memmove(buf, buf + send, len - send);
+        len -= send;
+
+        if (nl)
+        {
+            do
+                k = (k + 1) % nworkers;
+            while (outs[k] < 0);
+        }
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/* Copy the output of the NWORKERS pipes in INS to OUT as it comes,
+   a whole number of lines at a time, so that lines from different
+   workers are never interleaved.  Once part of a line longer than the
+   buffer has been written, only its worker is read until the line
+   ends.  */
+static void merge(int *ins, int nworkers, int out)
+{
+    struct pollfd *pfds = calloc(nworkers, sizeof *pfds);
+    char *bufs = malloc((size_t)nworkers * LINE_BUFFER);
+    size_t *lens = calloc(nworkers, sizeof *lens);
+    if (!pfds || !bufs || !lens)
+    {
+        perror("Error in malloc");
+        exit(errno);
+    }
+    for (int k = 0; k < nworkers; k++)
+    {
+        pfds[k].fd = ins[k];
+        pfds[k].events = POLLIN;
     }
 
-    for (int j = 0; j < argc - 1; j++)
+    int open = nworkers;
+    int partial = -1;
+    while (open > 0)
     {
-        cpid[j] = fork();
-        if (cpid[j] < 0)
+        int first = partial >= 0 ? partial : 0;
+        int count = partial >= 0 ? 1 : nworkers;
+        if (poll(pfds + first, count, -1) < 0)
         {
-            perror("Error in Fork");
+            if (errno == EINTR)
+                continue;
+            perror("Error in poll");
             exit(errno);
         }
+        for (int k = first; k < first + count; k++)
+        {
+            if (pfds[k].fd < 0 || !pfds[k].revents || (partial >= 0 && partial != k))
+                continue;
+
+            char *buf = bufs + (size_t)k * LINE_BUFFER;
+            ssize_t n = read(pfds[k].fd, buf + lens[k], LINE_BUFFER - lens[k]);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("Error in read");
+                exit(errno);
+            }
+            lens[k] += n;
+
+            char *nl = memrchr(buf, '\n', lens[k]);
+            size_t send = n == 0 ? lens[k] : nl ? (size_t)(nl - buf + 1)
+                          : lens[k] == LINE_BUFFER ? lens[k] : 0;
+            if (write_all(out, buf, send) < 0)
+            {
+                perror("Error in write");
+                exit(errno);
+            }
+            if (send > 0)
+                partial = n > 0 && buf[send - 1] != '\n' ? k : -1;
+            memmove(buf, buf + send, lens[k] - send);
+            lens[k] -= send;
+
+            if (n == 0)
+            {
+                partial = -1;
+                close(pfds[k].fd);
+                pfds[k].fd = -1;
+                open--;
+            }
+        }
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/* If ERR, an error number returned by a posix_spawn function, is
+   nonzero, report it with the message MSG and exit.  */
+static void check_spawn(int err, const char *msg)
+{
+    if (err != 0)
+    {
+        fprintf(stderr, "%s: %s\n", msg, strerror(err));
+        exit(err);
+    }
+}
+
+/* Run the command CMD with IN as its standard input and OUT as its
+   standard output, either of which may be -1 to leave it alone.  Store
+   its process ID into *PID and return 0, or return an error number
+   if it could not be run.  */
+static int spawn(pid_t *pid, char *cmd, int in, int out)
+{
+    posix_spawn_file_actions_t actions;
+    char *cmd_argv[] = {cmd, NULL};
+
+    check_spawn(posix_spawn_file_actions_init(&actions), "Error in Spawn Setup");
+    if (in >= 0)
+        check_spawn(posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO),
+                    "Error in Spawn Setup");
+    if (out >= 0)
+        check_spawn(posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO),
+                    "Error in Spawn Setup");
+
+    int err = posix_spawnp(pid, cmd, &actions, NULL, cmd_argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return err;
+}
+
+/* The number of lines the head builtin passes on, as for head(1).  */
+#define HEAD_LINES 10
+
+/* Copy IN to OUT with read and write.  */
+static int copy_fd(int in, int out)
+{
+    char buf[LINE_BUFFER];
+    for (;;)
+    {
+        ssize_t n = read(in, buf, sizeof buf);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (n == 0)
+            return 0;
+        if (write_all(out, buf, n) < 0)
+            return errno;
+    }
+}
+
+/* Copy IN to OUT with splice, so that the data stays in the kernel,
+   falling back to read and write if neither is a pipe.  */
+static int builtin_cat(int in, int out)
+{
+    for (;;)
+    {
+        ssize_t n = splice(in, NULL, out, NULL, LINE_BUFFER, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL)
+                return copy_fd(in, out);
+            return errno;
+        }
+        if (n == 0)
+            return 0;
+    }
+}
+
+/* Copy the first HEAD_LINES lines of IN to OUT.  */
+static int builtin_head(int in, int out)
+{
+    char buf[LINE_BUFFER];
+    int lines = 0;
+    while (lines < HEAD_LINES)
+    {
+        ssize_t n = read(in, buf, sizeof buf);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        if (n == 0)
+            break;
 
-        else if (cpid[j] == 0)
+        char *end = buf;
+        while (lines < HEAD_LINES && (end = memchr(end, '\n', buf + n - end)))
         {
-            if (j < argc - 2)
+            end++;
+            lines++;
+        }
+        if (write_all(out, buf, lines < HEAD_LINES ? (size_t)n : (size_t)(end - buf)) < 0)
+            return errno;
+    }
+    return 0;
+}
+
+static const struct builtin builtins[] = {
+    {"cat", builtin_cat},
+    {"head", builtin_head},
+};
+
+static const struct builtin *find_builtin(const char *cmd)
+{
+    for (size_t i = 0; i < sizeof builtins / sizeof *builtins; i++)
+    {
+        if (strcmp(builtins[i].name, cmd) == 0)
+            return &builtins[i];
+    }
+    return NULL;
+}
+
+/* Wake the launcher.  This is async-signal-safe.  */
+static void wake(void)
+{
+    uint64_t one = 1;
+    int saved = errno;
+    // This can only fail if the counter would overflow, which it cannot
+    // before the launcher reads it
+    ssize_t n = write(wake_fd, &one, sizeof one);
+    (void)n;
+    errno = saved;
+}
+
+static void on_sigchld(int sig)
+{
+    (void)sig;
+    wake();
+}
+
+/* Finish the builtin stage ARG, whether its thread returns or is
+   cancelled: close its descriptors, so that the stages on either side
+   see it go, and tell the launcher it has ended.  */
+static void end_builtin(void *arg)
+{
+    struct stage *s = arg;
+
+    close(s->in);
+    close(s->out);
+    getrusage(RUSAGE_THREAD, &s->usage);
+    clock_gettime(CLOCK_MONOTONIC, &s->end);
+    atomic_store(&s->ended, true);
+    wake();
+}
+
+/* The body of the thread running the builtin stage ARG.  Its wait
+   status is made up to look like that of a process: a write to a pipe
+   nobody reads any more ends it as if by SIGPIPE, and any other error
+   is reported and makes it exit with status 1.  */
+static void *run_builtin(void *arg)
+{
+    struct stage *s = arg;
+
+    // A broken pipe is left pending on this thread and shows up as
+    // EPIPE instead of killing the launcher
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+
+    pthread_cleanup_push(end_builtin, s);
+    int err = s->builtin->run(s->in, s->out);
+    if (err == EPIPE)
+    {
+        s->status = SIGPIPE;
+    }
+    else if (err != 0)
+    {
+        fprintf(stderr, "%s: %s\n", s->cmd, strerror(err));
+        s->status = W_EXITCODE(1, 0);
+    }
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+/* Start a thread running the builtin stage S on its own copies of IN
+   and OUT, or of standard input and output if they are -1.  Return 0,
+   or an error number if it could not be started.  */
+static int start_builtin(struct stage *s, int in, int out)
+{
+    s->in = fcntl(in >= 0 ? in : STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    s->out = fcntl(out >= 0 ? out : STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    int err = s->in < 0 || s->out < 0 ? errno
+                                      : pthread_create(&s->thread, NULL, run_builtin, s);
+    if (err != 0)
+    {
+        if (s->in >= 0)
+            close(s->in);
+        if (s->out >= 0)
+            close(s->out);
+    }
+    return err;
+}
+
+/* Start the process S with IN as its standard input and OUT as its
+   standard output, as for spawn, or as a thread if it names a builtin
+   and there is room for one, reporting on stderr if it could not be
+   run.  */
+static void launch(struct stage *s, int in, int out)
+{
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+    s->builtin = find_builtin(s->cmd);
+    if (s->builtin)
+    {
+        s->spawn_err = start_builtin(s, in, out);
+        // Out of descriptors or threads, the command can still be run
+        if (s->spawn_err == EMFILE || s->spawn_err == EAGAIN)
+            s->builtin = NULL;
+    }
+    if (!s->builtin)
+        s->spawn_err = spawn(&s->pid, s->cmd, in, out);
+    if (s->spawn_err != 0)
+    {
+        fprintf(stderr, "%s: %s\n", s->cmd, strerror(s->spawn_err));
+    }
+}
+
+/* Fork the helper process H.  Return 0 in the child, as fork does.  */
+static pid_t fork_helper(struct stage *h)
+{
+    clock_gettime(CLOCK_MONOTONIC, &h->start);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("Error in Fork");
+        exit(errno);
+    }
+    h->pid = pid;
+    return pid;
+}
+
+/* Start the stage whose NWORKERS workers are WORKERS[0] through
+   WORKERS[NWORKERS - 1], each with its own pipes in and out, along with
+   a distributor that deals the lines of IN out to them and a merger that
+   collects their lines into OUT, which are WORKERS[NWORKERS] and
+   WORKERS[NWORKERS + 1].  IN or OUT may be -1 for standard input
+   or output.  */
+static void launch_parallel(struct stage *workers, int in, int out)
+{
+    int nworkers = workers[0].nworkers;
+    int *to_workers = malloc((2 * nworkers + 1) * sizeof *to_workers);
+    int *from_workers = malloc((2 * nworkers + 1) * sizeof *from_workers);
+    if (!to_workers || !from_workers)
+    {
+        perror("Error in malloc");
+        exit(errno);
+    }
+
+    // Worker k reads to_workers[2k] and writes from_workers[2k + 1]
+    for (int k = 0; k < nworkers; k++)
+    {
+        make_pipe(&to_workers[2 * k]);
+        make_pipe(&from_workers[2 * k]);
+        launch(&workers[k], to_workers[2 * k], from_workers[2 * k + 1]);
+        close(to_workers[2 * k]);
+        close(from_workers[2 * k + 1]);
+    }
+    for (int k = 0; k < nworkers; k++)
+    {
+        to_workers[k] = to_workers[2 * k + 1];
+        from_workers[k] = from_workers[2 * k];
+    }
+
+    if (fork_helper(&workers[nworkers]) == 0)
+    {
+        to_workers[nworkers] = in;
+        close_all_but(to_workers, nworkers + 1);
+        distribute(in >= 0 ? in : STDIN_FILENO, to_workers, nworkers);
+    }
+    for (int k = 0; k < nworkers; k++)
+        close(to_workers[k]);
+
+    if (fork_helper(&workers[nworkers + 1]) == 0)
+    {
+        from_workers[nworkers] = out;
+        close_all_but(from_workers, nworkers + 1);
+        merge(from_workers, nworkers, out >= 0 ? out : STDOUT_FILENO);
+    }
+    for (int k = 0; k < nworkers; k++)
+        close(from_workers[k]);
+
+    free(to_workers);
+    free(from_workers);
+}
+
+static int compare_pids(const void *a, const void *b)
+{
+    pid_t x = (*(struct stage *const *)a)->pid, y = (*(struct stage *const *)b)->pid;
+    return (x > y) - (x < y);
+}
+
+/* Return the number of parallel workers asked for by the suffix ":N" on
+   the command CMD, removing it, or 1 if there is none.  Only a colon
+   followed by nothing but digits makes such a suffix, so that other
+   colons, as in a path, are left alone.  */
+static int parse_workers(char *cmd)
+{
+    char *colon = strrchr(cmd, ':');
+    if (!colon || !colon[1] || strspn(colon + 1, "0123456789") != strlen(colon + 1))
+        return 1;
+
+    char *end;
+    errno = 0;
+    long n = strtol(colon + 1, &end, 10);
+    if (end == colon + 1 || *end || errno || n < 1 || n > INT_MAX / 2)
+    {
+        fprintf(stderr, "%s: bad worker count '%s'\n", cmd, colon + 1);
+        exit(EINVAL);
+    }
+    *colon = '\0';
+    return n;
+}
+
+/* Return whether the wait status STATUS is that of a command that
+   failed.  Being killed by SIGPIPE is not a failure, since that is how
+   a command learns that the rest of the pipeline has stopped reading.  */
+static bool failed(int status)
+{
+    return WIFEXITED(status) ? WEXITSTATUS(status) != 0 : WTERMSIG(status) != SIGPIPE;
+}
+
+/* Report on stderr that the command S failed.  */
+static void report_failure(const struct stage *s)
+{
+    if (s->spawn_err != 0 || s->builtin)
+        return;  // Already reported when it was launched, or by the builtin
+    if (WIFEXITED(s->status))
+        fprintf(stderr, "%s: exited with status %d\n", s->cmd, WEXITSTATUS(s->status));
+    else
+        fprintf(stderr, "%s: %s\n", s->cmd, strsignal(WTERMSIG(s->status)));
+}
+
+/* Send SIGTERM to each of the NSTAGES processes in STAGES that is still
+   running, and cancel each builtin thread, which closes its descriptors
+   as it goes.  */
+static void stop_pipeline(struct stage *stages, int nstages)
+{
+    for (int j = 0; j < nstages; j++)
+    {
+        if (stages[j].spawn_err != 0 || stages[j].done)
+            continue;
+        if (stages[j].builtin)
+            pthread_cancel(stages[j].thread);
+        else
+            kill(stages[j].pid, SIGTERM);
+    }
+}
+
+/* Note that the stage S, one of the NSTAGES in STAGES, has ended with
+   wait status S->status.  If it failed, report it and record it in
+   *FIRST_FAILURE if it is the first; with FAIL_FAST, stop the rest of
+   the pipeline.  */
+static void stage_ended(struct stage *s, struct stage *stages, int nstages, bool fail_fast,
+                        struct stage **first_failure)
+{
+    s->done = true;
+
+    // Once the pipeline is being stopped, the rest of the failures are
+    // only the result of that
+    if (s->helper || !failed(s->status) || (fail_fast && *first_failure))
+        return;
+    report_failure(s);
+    if (!*first_failure)
+        *first_failure = s;
+    if (fail_fast)
+        stop_pipeline(stages, nstages);
+}
+
+/* Print a table of how long each of the NSTAGES processes in STAGES ran
+   and the resources it used to stderr.  Workers of a parallel stage are
+   numbered STAGE.WORKER.  */
+static void print_stats(const struct stage *stages, int nstages)
+{
+    fprintf(stderr, "%7s  %-16s  %9s  %9s  %9s  %10s  %9s  %9s  %6s\n", "Stage",
+            "Command", "Wall (s)", "User (s)", "Sys (s)", "MaxRSS (K)", "Vol CS",
+            "Invol CS", "Status");
+    for (int j = 0; j < nstages; j++)
+    {
+        const struct stage *s = &stages[j];
+        if (s->helper)
+            continue;
+
+        char name[32];
+        if (s->nworkers > 1)
+            snprintf(name, sizeof name, "%d.%d", s->index, s->worker);
+        else
+            snprintf(name, sizeof name, "%d", s->index);
+
+        if (s->spawn_err != 0)
+        {
+            fprintf(stderr, "%7s  %-16s  %9s  %9s  %9s  %10s  %9s  %9s  %6d\n", name,
+                    s->cmd, "-", "-", "-", "-", "-", "-", s->spawn_err);
+            continue;
+        }
+
+        // A thread's ru_maxrss is that of the whole launcher, so a
+        // builtin has none of its own to show
+        char maxrss[24] = "-";
+        if (!s->builtin)
+            snprintf(maxrss, sizeof maxrss, "%ld", s->usage.ru_maxrss);
+        fprintf(stderr, "%7s  %-16s  %9.3f  %9.3f  %9.3f  %10s  %9ld  %9ld  %6d\n", name,
+                s->cmd, seconds_between(&s->start, &s->end),
+                s->usage.ru_utime.tv_sec + s->usage.ru_utime.tv_usec / 1e6,
+                s->usage.ru_stime.tv_sec + s->usage.ru_stime.tv_usec / 1e6,
+                maxrss, s->usage.ru_nvcsw, s->usage.ru_nivcsw,
+                WIFEXITED(s->status) ? WEXITSTATUS(s->status) : 128 + WTERMSIG(s->status));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"fail-fast", no_argument, NULL, 'f'},
+        {"stats", no_argument, NULL, 's'},
+        {NULL, 0, NULL, 0},
+    };
+    bool fail_fast = false;
+    bool relay_mode = false;
+    bool stats = false;
+    int opt;
+
+    // Stop at the first command, so that options only come before it
+    while ((opt = getopt_long(argc, argv, "+b:frs", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            pipe_size = atoi(optarg);
+            if (pipe_size <= 0)
             {
-                if (dup2(fds[j][1], STDOUT_FILENO) < 0)
-                {
-                    perror("Error in dup2 for STDOUT");
-                    exit(errno);
-                }
-                close(fds[j][1]);
+                fprintf(stderr, "%s: bad pipe size '%s'\n", argv[0], optarg);
+                exit(EINVAL);
             }
+            break;
+        case 'f':
+            fail_fast = true;
+            break;
+        case 'r':
+            relay_mode = true;
+            break;
+        case 's':
+            stats = true;
+            break;
+        default:
+            exit(EINVAL);
+        }
+    }
+
+    char **cmds = argv + optind;
+    int ncmds = argc - optind;
+
+    if (ncmds < 1)
+    {
+        exit(EINVAL);
+    }
+    if (relay_mode && !pipe_size)
+    {
+        pipe_size = RELAY_PIPE_SIZE;
+    }
+
+    int st;
 
-            if (j != 0)
+    // One entry per process, in the order described at struct stage
+    struct stage *stages = NULL;
+    int nstages = 0, stages_alloc = 0;
+    for (int j = 0; j < ncmds; j++)
+    {
+        int nworkers = parse_workers(cmds[j]);
+        int nhelpers = (nworkers > 1 ? 2 : 0) + (relay_mode && j < ncmds - 1);
+        while (stages_alloc - nstages < nworkers + nhelpers)
+        {
+            stages_alloc = stages_alloc ? 2 * stages_alloc : 16;
+            stages = realloc(stages, stages_alloc * sizeof *stages);
+            if (!stages)
             {
-                if (dup2(fds[j - 1][0], STDIN_FILENO) < 0)
-                {
-                    perror("Error in dup2 for STDIN");
-                    exit(errno);
-                }
-                close(fds[j - 1][0]);
+                perror("Error in realloc");
+                exit(errno);
             }
+        }
+        for (int k = 0; k < nworkers; k++)
+        {
+            stages[nstages++] = (struct stage){
+                .cmd = cmds[j], .index = j, .worker = k, .nworkers = nworkers};
+        }
+        for (int k = 0; k < nhelpers; k++)
+        {
+            stages[nstages++] = (struct stage){
+                .cmd = cmds[j], .index = j, .nworkers = nworkers, .helper = true};
+        }
+    }
 
-            for (int l = 0; l < argc - 1; l++)
+    // Every child exit and builtin thread end wakes the wait below
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0)
+    {
+        perror("Error in eventfd");
+        exit(errno);
+    }
+    struct sigaction sa = {.sa_handler = on_sigchld, .sa_flags = SA_RESTART | SA_NOCLDSTOP};
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGCHLD, &sa, NULL) < 0)
+    {
+        perror("Error in sigaction");
+        exit(errno);
+    }
+
+    // Each pipe is made just before the command that writes it is started
+    // and closed as soon as the processes at both ends have their copies,
+    // so that the parent holds a handful of descriptors however long the
+    // pipeline is.  Command j writes to link; in relay mode a relay moves
+    // that to relay_link, which command j + 1 reads, and otherwise
+    // command j + 1 reads link directly.
+    int in = -1;
+
+    for (int j = 0, s = 0; j < ncmds; j++)
+    {
+        int link[2] = {-1, -1};
+        if (j < ncmds - 1)
+        {
+            make_pipe(link);
+        }
+        int out = link[1];
+
+        if (stages[s].nworkers == 1)
+        {
+            launch(&stages[s], in, out);
+            s++;
+        }
+        else
+        {
+            launch_parallel(&stages[s], in, out);
+            s += stages[s].nworkers + 2;
+        }
+
+        if (out >= 0)
+        {
+            close(out);
+        }
+        if (in >= 0)
+        {
+            close(in);
+        }
+
+        in = link[0];
+
+        if (relay_mode && j < ncmds - 1)
+        {
+            int relay_link[2];
+            make_pipe(relay_link);
+
+            if (fork_helper(&stages[s++]) == 0)
             {
-                if (l != j)
-                    close(fds[l][1]);
-                if (l != j - 1)
-                    close(fds[l][0]);
+                close_all_but((int[]){link[0], relay_link[1]}, 2);
+                relay(link[0], relay_link[1], cmds[j], cmds[j + 1]);
             }
+            close(link[0]);
+            close(relay_link[1]);
+            in = relay_link[0];
+        }
+    }
+
+    // Reap children and join builtin threads as they end, so that each
+    // stage's end time is when it actually finished rather than when the
+    // stages before it did, and so that --fail-fast can act on any of them
+    struct stage **by_pid = malloc(nstages * sizeof *by_pid);
+    if (!by_pid)
+    {
+        perror("Error in malloc");
+        exit(errno);
+    }
+    int nrunning = 0, nthreads = 0;
+    for (int j = 0; j < nstages; j++)
+    {
+        if (stages[j].spawn_err != 0)
+            continue;
+        if (stages[j].builtin)
+            nthreads++;
+        else
+            by_pid[nrunning++] = &stages[j];
+    }
+    qsort(by_pid, nrunning, sizeof *by_pid, compare_pids);
 
-            execlp(argv[j + 1], argv[j + 1], NULL);
-            perror("execlp");
+    // The first command to fail, and with --fail-fast the one that
+    // brought down the rest of the pipeline
+    struct stage *first_failure = NULL;
+    for (int j = 0; j < nstages && !first_failure; j++)
+    {
+        if (stages[j].spawn_err != 0)
+            first_failure = &stages[j];
+    }
+    if (fail_fast && first_failure)
+    {
+        stop_pipeline(stages, nstages);
+    }
+
+    // Each end writes to wake_fd after it happens, so whatever has ended
+    // by the time a read returns is found below, and anything later wakes
+    // the next read
+    int children = nrunning, running = nrunning + nthreads;
+    while (running > 0)
+    {
+        uint64_t wakes;
+        if (read(wake_fd, &wakes, sizeof wakes) < 0 && errno != EINTR)
+        {
+            perror("Error in reading eventfd");
             exit(errno);
         }
 
-        else
+        struct rusage usage;
+        pid_t pid;
+        while (children > 0 && (pid = wait4(-1, &st, WNOHANG, &usage)) != 0)
         {
-            close(fds[j][1]);
-            if (j != 0)
+            if (pid < 0)
             {
-                close(fds[j - 1][0]);
+                if (errno == EINTR)
+                    continue;
+                perror("Error in wait4");
+                exit(errno);
             }
+
+            struct stage key = {.pid = pid}, *keyp = &key;
+            struct stage **found = bsearch(&keyp, by_pid, nrunning, sizeof *by_pid, compare_pids);
+            children--;
+            if (!found)
+                continue;
+
+            struct stage *s = *found;
+            clock_gettime(CLOCK_MONOTONIC, &s->end);
+            s->status = st;
+            s->usage = usage;
+            running--;
+            stage_ended(s, stages, nstages, fail_fast, &first_failure);
+        }
+
+        for (int j = 0; j < nstages; j++)
+        {
+            struct stage *s = &stages[j];
+            if (s->spawn_err != 0 || !s->builtin || s->done || !atomic_load(&s->ended))
+                continue;
+
+            void *result;
+            pthread_join(s->thread, &result);
+            if (result == PTHREAD_CANCELED)
+                s->status = SIGTERM;
+            running--;
+            stage_ended(s, stages, nstages, fail_fast, &first_failure);
         }
     }
+    free(by_pid);
+    close(wake_fd);
 
     int exit_status = EXIT_SUCCESS;
 
-    for (int j = 0; j < argc - 1; j++)
+    for (int j = 0; j < nstages; j++)
     {
-        waitpid(cpid[j], &st, 0);
+        if (stages[j].helper)
+            continue;
+        if (stages[j].spawn_err != 0)
+        {
+            exit_status = stages[j].spawn_err;
+            continue;
+        }
+        st = stages[j].status;
         if (!WIFEXITED(st) || WEXITSTATUS(st) != 0)
         {
             exit_status = WEXITSTATUS(st);
         }
     }
+    if (fail_fast && first_failure)
+    {
+        st = first_failure->status;
+        exit_status = first_failure->spawn_err != 0 ? first_failure->spawn_err
+                      : WIFEXITED(st)               ? WEXITSTATUS(st)
+                                                    : 128 + WTERMSIG(st);
+    }
+
+    if (stats)
+    {
+        print_stats(stages, nstages);
+    }
 
+    free(stages);
     exit(exit_status);
 }
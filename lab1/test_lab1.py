@@ -1,3 +1,4 @@
+import os
 import pathlib
 import re
 import subprocess
@@ -52,6 +53,115 @@ class TestLab1(unittest.TestCase):
         subprocess.call(['rm', 'trace.log'])
         self.assertTrue(self._make_clean, msg='make clean failed')
     
+    def test_relay(self):
+        self.assertTrue(self.make, msg='make failed')
+        cl_result = subprocess.run(('ls | cat | wc'),
+                                capture_output=True, shell=True)
+        pipe_result = subprocess.run(('./pipe', '-r', 'ls', 'cat', 'wc'),
+                                     capture_output=True)
+        self.assertEqual(cl_result.stdout, pipe_result.stdout,
+            msg=f"The output from ./pipe -r should be {cl_result.stdout} but got {pipe_result.stdout} instead.")
+        links = pipe_result.stderr.decode("utf-8").splitlines()
+        self.assertEqual(len(links), 2, msg='Each link should be reported once.')
+        self.assertTrue(links[0].startswith('ls -> cat: '),
+            msg=f"Unexpected link report {links[0]}")
+        self.assertTrue(self._make_clean, msg='make clean failed')
+
+    def test_stats(self):
+        self.assertTrue(self.make, msg='make failed')
+        cl_result = subprocess.run(('ls | cat | wc'),
+                                capture_output=True, shell=True)
+        pipe_result = subprocess.run(('./pipe', '--stats', 'ls', 'cat', 'wc'),
+                                     capture_output=True)
+        self.assertEqual(cl_result.stdout, pipe_result.stdout,
+            msg=f"The output from ./pipe --stats should be {cl_result.stdout} but got {pipe_result.stdout} instead.")
+        rows = pipe_result.stderr.decode("utf-8").splitlines()
+        self.assertEqual(len(rows), 4, msg='Expected a header and one row per stage.')
+        self.assertEqual([row.split()[1] for row in rows[1:]], ['ls', 'cat', 'wc'],
+            msg=f"Unexpected stats table {rows}")
+        self.assertTrue(all(row.split()[-1] == '0' for row in rows[1:]),
+            msg=f"Every stage should exit with status 0: {rows}")
+        self.assertEqual(rows[2].split()[5], '-',
+            msg=f"The builtin cat should show no MaxRSS of its own: {rows}")
+        self.assertTrue(self._make_clean, msg='make clean failed')
+
+    def test_parallel(self):
+        self.assertTrue(self.make, msg='make failed')
+        cl_result = subprocess.run(('ls | cat | wc'),
+                                capture_output=True, shell=True)
+        pipe_result = subprocess.run(('./pipe', 'ls', 'cat:4', 'wc'),
+                                     capture_output=True)
+        self.assertEqual(cl_result.stdout, pipe_result.stdout,
+            msg=f"The output from ./pipe ls cat:4 wc should be {cl_result.stdout} but got {pipe_result.stdout} instead.")
+        lines = b''.join(b'%d %s\n' % (i, b'x' * (i % 1000)) for i in range(100000))
+        pipe_result = subprocess.run(('./pipe', 'cat:3', 'sort'), input=lines,
+                                     capture_output=True)
+        self.assertEqual(pipe_result.stdout, b''.join(sorted(lines.splitlines(True))),
+            msg='Every line should reach the output whole, exactly once.')
+        self.assertTrue(self._make_clean, msg='make clean failed')
+
+    def test_colon_command(self):
+        self.assertTrue(self.make, msg='make failed')
+        # A colon that is not followed by a worker count is part of the path
+        os.makedirs('d:x', exist_ok=True)
+        try:
+            os.symlink('/bin/cat', 'd:x/cat')
+            pipe_result = subprocess.run(('./pipe', 'ls', './d:x/cat'), capture_output=True)
+            ls_result = subprocess.check_output('ls')
+        finally:
+            os.remove('d:x/cat')
+            os.rmdir('d:x')
+        self.assertEqual(pipe_result.returncode, 0, msg=pipe_result.stderr)
+        self.assertEqual(pipe_result.stdout, ls_result)
+        self.assertTrue(self._make_clean, msg='make clean failed')
+
+    def test_fail_fast(self):
+        self.assertTrue(self.make, msg='make failed')
+        # cat waits on a standard input that never closes, so only
+        # stopping the pipeline when false fails lets it finish
+        with subprocess.Popen(('./pipe', '--fail-fast', 'cat', 'false'),
+                              stdin=subprocess.PIPE, stderr=subprocess.PIPE) as proc:
+            try:
+                _, err = proc.communicate(timeout=5)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+                self.fail('The pipeline should stop as soon as false fails.')
+            finally:
+                proc.stdin.close()
+        self.assertEqual(proc.returncode, 1, msg='Expected the exit status of false.')
+        self.assertIn(b'false: exited with status 1', err,
+            msg='The failure should be reported to standard error.')
+        self.assertTrue(self._make_clean, msg='make clean failed')
+
+    def test_fail_fast_builtin(self):
+        self.assertTrue(self.make, msg='make failed')
+        # The builtin cat fails reading a directory while yes runs forever
+        root = os.open('/', os.O_RDONLY)
+        try:
+            pipe_result = subprocess.run(('./pipe', '--fail-fast', 'cat', 'yes'),
+                                         stdin=root, stdout=subprocess.DEVNULL,
+                                         stderr=subprocess.PIPE, timeout=5)
+        except subprocess.TimeoutExpired:
+            self.fail('The pipeline should stop as soon as the builtin cat fails.')
+        finally:
+            os.close(root)
+        self.assertEqual(pipe_result.returncode, 1, msg='Expected the exit status of cat.')
+        self.assertIn(b'cat: Is a directory', pipe_result.stderr,
+            msg='The failure should be reported to standard error.')
+        self.assertTrue(self._make_clean, msg='make clean failed')
+
+    def test_builtins(self):
+        self.assertTrue(self.make, msg='make failed')
+        lines = b''.join(b'%d\n' % i for i in range(100000))
+        for cmds in (('cat', 'head'), ('/bin/cat', 'head'), ('cat', 'cat:2', 'cat')):
+            pipe_result = subprocess.run(('./pipe',) + cmds, input=lines,
+                                         capture_output=True)
+            expected = lines if cmds[-1] == 'cat' else b''.join(lines.splitlines(True)[:10])
+            self.assertEqual(sorted(pipe_result.stdout.splitlines()), sorted(expected.splitlines()),
+                msg=f"Unexpected output from ./pipe {' '.join(cmds)}")
+            self.assertEqual(pipe_result.returncode, 0)
+        self.assertTrue(self._make_clean, msg='make clean failed')
+
     def test_bogus(self):
         self.assertTrue(self.make, msg='make failed')
         pipe_result = subprocess.run(('./pipe', 'ls', 'bogus'), stdout=subprocess.PIPE,
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Time rr on synthetic workloads of each size in $BENCH_SIZES, for each
+# arrival process and burst distribution, with each quantum setting in
+# $BENCH_QUANTA.  The mean burst is just under the mean interarrival
+# time, so the simulated CPU is busy but the run queue stays bounded.
+
+set -e
+
+sizes=${BENCH_SIZES:-"10000 100000 1000000"}
+quanta=${BENCH_QUANTA:-"10 median"}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+printf '%10s  %-8s  %-7s  %-7s  %9s\n' Processes Arrivals Bursts Quantum Seconds
+for n in $sizes; do
+    for arrival in poisson bursty; do
+        for burst in exp pareto; do
+            file=$dir/$n-$arrival-$burst.txt
+            ./rr-gen -n "$n" -a "$arrival" -A 10 -b "$burst" -B 8 > "$file"
+            for q in $quanta; do
+                start=$(date +%s.%N)
+                ./rr "$file" "$q" > /dev/null
+                end=$(date +%s.%N)
+                awk -v n="$n" -v a="$arrival" -v b="$burst" -v q="$q" \
+                    -v start="$start" -v end="$end" \
+                    'BEGIN { printf "%10s  %-8s  %-7s  %-7s  %9.3f\n", n, a, b, q, end - start }'
+            done
+            rm -f "$file"
+        done
+    done
+done
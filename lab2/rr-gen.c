@@ -0,0 +1,251 @@
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* The largest burst time generated, so that heavy tails cannot overflow
+   the simulator's clock.  */
+#define MAX_BURST 1000000000000L
+
+/* Arrivals in a bursty workload come in groups of this many processes
+   on average, spaced this many times closer than the overall mean.  */
+#define BURST_GROUP 10
+
+/* The shape of heavy-tailed burst times: Pareto with this index has a
+   finite mean but infinite variance.  */
+#define PARETO_ALPHA 1.5
+
+/* Output is buffered this many bytes at a time.  */
+#define OUT_BUFFER (1 << 20)
+
+/* A splitmix64 generator, so that a seed gives the same workload
+   everywhere.  */
+static uint64_t rng_state;
+
+static uint64_t
+rng_next(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+/* Return a uniform random number in (0, 1].  */
+static double
+rng_unit(void)
+{
+    return ((rng_next() >> 11) + 1) * 0x1.0p-53;
+}
+
+static double
+rng_exponential(double mean)
+{
+    return -mean * log(rng_unit());
+}
+
+static bool
+rng_bernoulli(double p)
+{
+    return rng_unit() <= p;
+}
+
+/* Return the next arrival time in a workload whose arrivals are a
+   Poisson process with mean interarrival time MEAN, given that the
+   current time is *CLOCK.  */
+static double
+arrive_poisson(double *clock, double mean)
+{
+    return *clock += rng_exponential(mean);
+}
+
+/* Like arrive_poisson, but arrivals come in groups of BURST_GROUP
+   processes on average, separated by idle gaps long enough that the
+   mean interarrival time is still MEAN.  */
+static double
+arrive_bursty(double *clock, double mean)
+{
+    double within = mean / BURST_GROUP;
+    if (rng_bernoulli(1.0 / BURST_GROUP))
+        *clock += rng_exponential(mean * BURST_GROUP - within * (BURST_GROUP - 1));
+    else
+        *clock += rng_exponential(within);
+    return *clock;
+}
+
+static double
+burst_exponential(double mean)
+{
+    return rng_exponential(mean);
+}
+
+/* Return a Pareto-distributed burst time with mean MEAN.  */
+static double
+burst_pareto(double mean)
+{
+    double scale = mean * (PARETO_ALPHA - 1) / PARETO_ALPHA;
+    return scale / pow(rng_unit(), 1 / PARETO_ALPHA);
+}
+
+struct distribution
+{
+    char const *name;
+    double (*arrive)(double *clock, double mean);
+    double (*burst)(double mean);
+};
+
+static struct distribution const arrivals[] = {
+    {"poisson", arrive_poisson, NULL},
+    {"bursty", arrive_bursty, NULL},
+};
+
+static struct distribution const bursts[] = {
+    {"exp", NULL, burst_exponential},
+    {"pareto", NULL, burst_pareto},
+};
+
+static struct distribution const *
+find_distribution(struct distribution const *d, size_t n, char const *name)
+{
+    for (size_t i = 0; i < n; i++)
+        if (strcmp(d[i].name, name) == 0)
+            return &d[i];
+    return NULL;
+}
+
+/* Return the number ARG, which must be positive.  Report an error and
+   exit if it is not.  */
+static double
+positive(char const *program, char const *arg)
+{
+    char *end;
+    errno = 0;
+    double d = strtod(arg, &end);
+    if (end == arg || *end || errno || !(0 < d))
+    {
+        fprintf(stderr, "%s: '%s' is not a positive number\n", program, arg);
+        exit(1);
+    }
+    return d;
+}
+
+/* A buffer of output not yet written to standard output.  */
+static char out[OUT_BUFFER];
+static size_t out_len;
+
+static void
+out_flush(void)
+{
+    if (fwrite(out, 1, out_len, stdout) != out_len)
+    {
+        perror("stdout");
+        exit(1);
+    }
+    out_len = 0;
+}
+
+/* Append the decimal digits of N, then the string SUFFIX of length
+   SUFFIX_LEN, to the output.  */
+static void
+out_long(long n, char const *suffix, size_t suffix_len)
+{
+    char digits[24];
+    char *d = digits + sizeof digits;
+
+    do
+        *--d = '0' + n % 10;
+    while ((n /= 10) != 0);
+
+    size_t len = digits + sizeof digits - d;
+    if (OUT_BUFFER - out_len < len + suffix_len)
+        out_flush();
+    memcpy(out + out_len, d, len);
+    memcpy(out + out_len + len, suffix, suffix_len);
+    out_len += len + suffix_len;
+}
+
+int main(int argc, char *argv[])
+{
+    long count = 1000;
+    double mean_arrival = 10, mean_burst = 8;
+    struct distribution const *arrival = &arrivals[0];
+    struct distribution const *burst = &bursts[0];
+    int opt;
+
+    rng_state = 1;
+    while ((opt = getopt(argc, argv, "a:A:b:B:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            arrival = find_distribution(arrivals, sizeof arrivals / sizeof *arrivals,
+                                        optarg);
+            if (!arrival)
+            {
+                fprintf(stderr, "%s: unknown arrival process '%s' (expected poisson or bursty)\n",
+                        argv[0], optarg);
+                return 1;
+            }
+            break;
+        case 'A':
+            mean_arrival = positive(argv[0], optarg);
+            break;
+        case 'b':
+            burst = find_distribution(bursts, sizeof bursts / sizeof *bursts, optarg);
+            if (!burst)
+            {
+                fprintf(stderr, "%s: unknown burst distribution '%s' (expected exp or pareto)\n",
+                        argv[0], optarg);
+                return 1;
+            }
+            break;
+        case 'B':
+            mean_burst = positive(argv[0], optarg);
+            break;
+        case 'n':
+            count = positive(argv[0], optarg);
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (optind != argc)
+    {
+    usage:
+        fprintf(stderr, "%s: usage: %s [-n count] [-a poisson|bursty] [-A mean_arrival] "
+                        "[-b exp|pareto] [-B mean_burst] [-s seed]\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    // Arrival times are the integer parts of a continuous clock, so
+    // several processes may arrive at the same tick.  Burst times are
+    // rounded up, since a process must run for at least one tick.
+    double clock = 0;
+    out_long(count, "\n", 1);
+    for (long pid = 1; pid <= count; pid++)
+    {
+        double b = ceil(burst->burst(mean_burst));
+        if (b < 1)
+            b = 1;
+        out_long(pid, ", ", 2);
+        out_long((long)arrival->arrive(&clock, mean_arrival), ", ", 2);
+        out_long(b < MAX_BURST ? (long)b : MAX_BURST, "\n", 1);
+    }
+    out_flush();
+
+    if (fflush(stdout) < 0 || ferror(stdout))
+    {
+        perror("stdout");
+        return 1;
+    }
+    return 0;
+}
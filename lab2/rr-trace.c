@@ -0,0 +1,167 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Records are read this many at a time.  */
+#define READ_RECORDS 4096
+
+static char const *const kind_name[] = {
+    [TRACE_SWITCH] = "switch",
+    [TRACE_DISPATCH] = "dispatch",
+    [TRACE_EXPIRE] = "expire",
+    [TRACE_PREEMPT] = "preempt",
+    [TRACE_COMPLETE] = "complete",
+};
+
+static void
+print_text(struct trace_record const *r)
+{
+    printf("%lld: cpu %d %s pid %lld", (long long)r->time, r->cpu,
+           kind_name[r->kind], (long long)r->pid);
+    switch (r->kind)
+    {
+    case TRACE_SWITCH:
+        printf(" cost %lld", (long long)r->arg);
+        break;
+    case TRACE_DISPATCH:
+        printf(" slice %lld", (long long)r->arg);
+        break;
+    case TRACE_EXPIRE:
+    case TRACE_PREEMPT:
+        printf(" remaining %lld", (long long)r->arg);
+        break;
+    }
+    printf("\n");
+}
+
+/* Print R as a Chrome trace event, one simulated tick to a microsecond
+   and one CPU to a thread: each time a process runs is a slice named for
+   it, and each context switch is a slice named "switch".  */
+static void
+print_json(struct trace_record const *r)
+{
+    switch (r->kind)
+    {
+    case TRACE_SWITCH:
+        printf(",\n{\"name\":\"switch\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+               "\"pid\":0,\"tid\":%d,\"args\":{\"to\":%lld}}",
+               (long long)r->time, (long long)r->arg, r->cpu, (long long)r->pid);
+        break;
+    case TRACE_DISPATCH:
+        printf(",\n{\"name\":\"pid %lld\",\"ph\":\"B\",\"ts\":%lld,\"pid\":0,\"tid\":%d}",
+               (long long)r->pid, (long long)r->time, r->cpu);
+        break;
+    default:
+        printf(",\n{\"ph\":\"E\",\"ts\":%lld,\"pid\":0,\"tid\":%d,"
+               "\"args\":{\"end\":\"%s\",\"remaining\":%lld}}",
+               (long long)r->time, r->cpu, kind_name[r->kind], (long long)r->arg);
+        break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            json = true;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (argc - optind != 1)
+    {
+    usage:
+        fprintf(stderr, "%s: usage: %s [-j] trace_file\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    char const *filename = argv[optind];
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+    {
+        perror(filename);
+        return 1;
+    }
+
+    struct trace_header header;
+    if (fread(&header, sizeof header, 1, f) != 1
+        || memcmp(header.magic, TRACE_MAGIC, sizeof TRACE_MAGIC) != 0
+        || header.version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s: %s: not an rr trace\n", argv[0], filename);
+        return 1;
+    }
+
+    if (json)
+    {
+        printf("{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+               "\"args\":{\"name\":\"rr\"}}");
+        for (uint32_t i = 0; i < header.ncpus; i++)
+            printf(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                   "\"args\":{\"name\":\"CPU %u\"}}", i, i);
+    }
+
+    struct trace_record *buf = malloc(READ_RECORDS * sizeof *buf);
+    if (!buf)
+    {
+        perror("malloc");
+        return 1;
+    }
+
+    // Records are read as bytes, so that a partial record at the end
+    // shows up even if the trace comes from a pipe
+    size_t got, partial = 0;
+    while ((got = fread(buf, 1, READ_RECORDS * sizeof *buf, f)) != 0)
+    {
+        size_t n = got / sizeof *buf;
+        partial = got % sizeof *buf;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (buf[i].kind > TRACE_COMPLETE)
+            {
+                fprintf(stderr, "%s: %s: bad event kind %u\n", argv[0], filename,
+                        buf[i].kind);
+                return 1;
+            }
+            if (json)
+                print_json(&buf[i]);
+            else
+                print_text(&buf[i]);
+        }
+    }
+    if (ferror(f))
+    {
+        perror(filename);
+        return 1;
+    }
+    if (partial != 0)
+    {
+        fprintf(stderr, "%s: %s: truncated trace\n", argv[0], filename);
+        return 1;
+    }
+
+    if (json)
+        printf("\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    if (fflush(stdout) < 0 || ferror(stdout))
+    {
+        perror("stdout");
+        return 1;
+    }
+
+    free(buf);
+    fclose(f);
+    return 0;
+}
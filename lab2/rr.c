@@ -1,30 +1,60 @@
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include "stdckdint.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-/* A process table entry.  */
+#include "trace.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* A process table entry.  Only processes in the system have one, and
+   the bookkeeping of different policies shares storage, so that the
+   entries of a large simulation stay small.  */
 struct process
 {
     long pid;
     long arrival_time;
     long burst_time;
 
-    TAILQ_ENTRY(process)
-    pointers;
-
     /* Additional fields here */
     long rem_time;   /* Remaining time for the process */
     long start_time; /* Time when the process first started execution */
-    long end_time;   /* Time when the process finished execution */
-    long cpu_time;   /* Total CPU time used by the process */
+    long seq;        /* Position in order of arrival */
+    long slice_end;  /* When its current time slice ends */
+    long heap_index; /* Position in the run queue heap, or while running
+                        in the heap of running processes */
+    int cpu;         /* CPU this process is running on or last ran on */
     bool ran_before; /* Indicates whether the process has run before or not */
+
+    /* Bookkeeping for the scheduling policy, or the free list */
+    union
+    {
+        bool heap_low; /* rr: whether in the lower median heap */
+        struct
+        {
+            TAILQ_ENTRY(process) pointers;
+            int mlfq_level;  /* mlfq: current priority level, 0 being highest */
+            long mlfq_used;  /* mlfq: CPU time used at that level */
+            long mlfq_epoch; /* mlfq: priority boosts seen by this process */
+        };
+        struct
+        {
+            long vruntime; /* cfs: virtual runtime */
+            struct process *rb_left, *rb_right; /* cfs: red-black tree children */
+            bool rb_red;   /* cfs: whether the link from the parent is red */
+        };
+        struct process *next_free; /* Next unused entry in the pool */
+    };
     /* End of "Additional fields here" */
 };
 
@@ -75,325 +105,2232 @@ next_int_from_c_str(char const *data)
     return next_int(&data, strchr(data, 0));
 }
 
-/* A vector of processes of length NPROCESSES; the vector consists of
-   PROCESS[0], ..., PROCESS[NPROCESSES - 1].  */
+/* The processes in a file, as parallel vectors of length NPROCESSES:
+   process I has PID[I], ARRIVAL_TIME[I] and BURST_TIME[I].  */
 struct process_set
 {
     long nprocesses;
-    struct process *process;
+    long *pid;
+    long *arrival_time;
+    long *burst_time;
 };
 
-/* Return a vector of processes scanned from the file named FILENAME.
-   Report an error and exit on failure.  */
-static struct process_set
-init_processes(char const *filename)
+/* Process files are read in chunks of this many bytes.  */
+#define READ_CHUNK (1 << 20)
+
+/* A process file read sequentially, a chunk at a time.  The bytes not
+   yet scanned are POS..END, within BUF.  */
+struct process_reader
+{
+    int fd;
+    long nprocesses; /* Number of processes in the file */
+    char *buf;
+    char *pos, *end;
+    bool eof;
+};
+
+#ifdef __SSE2__
+/* Return a mask whose bit I is set if P[I] is a decimal digit, for I in
+   0..15.  Subtracting '0' + 128 maps '0'...'9' to the ten smallest
+   signed bytes, so that one signed comparison classifies all sixteen
+   bytes at once.  */
+static unsigned
+digit_mask(char const *p)
+{
+    __m128i bytes = _mm_loadu_si128((__m128i const *)p);
+    __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8((char)('0' + 128)));
+    return _mm_movemask_epi8(_mm_cmplt_epi8(shifted, _mm_set1_epi8(-128 + 10)));
+}
+#endif
+
+/* Return the first byte in P..END that is a decimal digit if DIGIT, or
+   that is not one otherwise.  Return END if there is no such byte.  */
+static char *
+find_digit(char *p, char *end, bool digit)
 {
-    int fd = open(filename, O_RDONLY);
-    if (fd < 0)
+#ifdef __SSE2__
+    for (; 16 <= end - p; p += 16)
     {
-        perror("open");
-        exit(1);
+        unsigned mask = digit_mask(p) ^ (digit ? 0 : 0xffff);
+        if (mask)
+            return p + __builtin_ctz(mask);
     }
+#endif
+    for (; p < end; p++)
+        if (('0' <= *p && *p <= '9') == digit)
+            return p;
+    return end;
+}
 
-    struct stat st;
-    if (fstat(fd, &st) < 0)
+/* Move R's unscanned bytes to the start of its buffer and read as much
+   of the next chunk as fits after them.  Report an error and exit on
+   failure.  */
+static void
+reader_fill(struct process_reader *r)
+{
+    size_t left = r->end - r->pos;
+    memmove(r->buf, r->pos, left);
+    r->pos = r->buf;
+    r->end = r->buf + left;
+
+    ssize_t n = read(r->fd, r->end, READ_CHUNK - left);
+    if (n < 0)
     {
-        perror("stat");
+        perror("read");
         exit(1);
     }
+    r->end += n;
+    r->eof = (n == 0);
+}
 
-    size_t size;
-    if (ckd_add(&size, st.st_size, 0))
+/* Like next_int, but scan from R, reading more of the file as needed.  */
+static long
+reader_next_int(struct process_reader *r)
+{
+    for (;;)
     {
-        fprintf(stderr, "%s: file size out of range\n", filename);
-        exit(1);
+        r->pos = find_digit(r->pos, r->end, true);
+        char *digits_end = find_digit(r->pos, r->end, false);
+
+        if (r->pos == r->end && r->eof)
+        {
+            fprintf(stderr, "missing integer\n");
+            exit(1);
+        }
+
+        if (digits_end < r->end || (r->eof && r->pos < r->end))
+        {
+            // Up to 18 digits cannot overflow, so check only longer runs
+            long current = 0;
+            bool overflow = false;
+            if (digits_end - r->pos <= 18)
+                for (char const *d = r->pos; d < digits_end; d++)
+                    current = current * 10 + (*d - '0');
+            else
+                for (char const *d = r->pos; d < digits_end; d++)
+                    overflow |= (ckd_mul(&current, current, 10)
+                                 || ckd_add(&current, current, *d - '0'));
+            if (overflow)
+            {
+                fprintf(stderr, "integer overflow\n");
+                exit(1);
+            }
+
+            r->pos = digits_end;
+            return current;
+        }
+
+        // The integer may continue past the buffer, so read more of it;
+        // a buffer full of digits would be far too long an integer
+        if (r->pos == r->buf && r->end == r->buf + READ_CHUNK)
+        {
+            fprintf(stderr, "integer overflow\n");
+            exit(1);
+        }
+        reader_fill(r);
     }
+}
 
-    char *data_start = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-    if (data_start == MAP_FAILED)
+/* Scan the process count at the start of R's file into R->NPROCESSES.  */
+static void
+reader_start(struct process_reader *r)
+{
+    r->pos = r->end = r->buf;
+    r->eof = false;
+    r->nprocesses = reader_next_int(r);
+    if (r->nprocesses <= 0)
     {
-        perror("mmap");
+        fprintf(stderr, "no processes\n");
         exit(1);
     }
+}
 
-    char const *data_end = data_start + size;
-    char const *data = data_start;
+/* Open the process file named FILENAME for reading with R, and scan its
+   process count.  A FILENAME of "-" stands for standard input, which has
+   no process count and goes on until end of file; R->NPROCESSES is then
+   -1.  Report an error and exit on failure.  */
+static void
+reader_open(struct process_reader *r, char const *filename)
+{
+    bool feed = strcmp(filename, "-") == 0;
 
-    long nprocesses = next_int(&data, data_end);
-    if (nprocesses <= 0)
+    r->fd = feed ? STDIN_FILENO : open(filename, O_RDONLY);
+    if (r->fd < 0)
     {
-        fprintf(stderr, "no processes\n");
+        perror("open");
         exit(1);
     }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
-    struct process *process = calloc(sizeof *process, nprocesses);
-    if (!process)
+    r->buf = malloc(READ_CHUNK);
+    if (!r->buf)
     {
-        perror("calloc");
+        perror("malloc");
         exit(1);
     }
 
-    for (long i = 0; i < nprocesses; i++)
+    if (feed)
     {
-        process[i].pid = next_int(&data, data_end);
-        process[i].arrival_time = next_int(&data, data_end);
-        process[i].burst_time = next_int(&data, data_end);
-        if (process[i].burst_time == 0)
-        {
-            fprintf(stderr, "process %ld has zero burst time\n",
-                    process[i].pid);
-            exit(1);
-        }
+        r->pos = r->end = r->buf;
+        r->eof = false;
+        r->nprocesses = -1;
+    }
+    else
+        reader_start(r);
+}
+
+/* Return true if only nondigits are left in R's file.  */
+static bool
+reader_at_end(struct process_reader *r)
+{
+    for (;;)
+    {
+        r->pos = find_digit(r->pos, r->end, true);
+        if (r->pos < r->end)
+            return false;
+        if (r->eof)
+            return true;
+        reader_fill(r);
     }
+}
 
-    if (munmap(data_start, size) < 0)
+/* Start reading R's file over from the beginning.  */
+static void
+reader_rewind(struct process_reader *r)
+{
+    if (lseek(r->fd, 0, SEEK_SET) < 0)
     {
-        perror("munmap");
+        perror("lseek");
         exit(1);
     }
-    if (close(fd) < 0)
+    reader_start(r);
+}
+
+static void
+reader_close(struct process_reader *r)
+{
+    if (close(r->fd) < 0)
     {
         perror("close");
         exit(1);
     }
-    return (struct process_set){nprocesses, process};
+    free(r->buf);
 }
 
-int main(int argc, char *argv[])
+/* Scan the next process from R into *P.  Report an error and exit on
+   failure.  */
+static void
+reader_next_process(struct process_reader *r, struct process *p)
 {
-    if (argc != 3)
+    p->pid = reader_next_int(r);
+    p->arrival_time = reader_next_int(r);
+    p->burst_time = reader_next_int(r);
+    if (p->burst_time == 0)
     {
-        fprintf(stderr, "%s: usage: %s file quantum\n", argv[0], argv[0]);
-        return 1;
+        fprintf(stderr, "process %ld has zero burst time\n", p->pid);
+        exit(1);
     }
+}
 
-    struct process_set ps = init_processes(argv[1]);
-    long quantum_length = (strcmp(argv[2], "median") == 0 ? -1
-                                                          : next_int_from_c_str(argv[2]));
-    if (quantum_length == 0)
+/* Return the processes in the file that R has just started reading.
+   Report an error and exit on failure.  */
+static struct process_set
+init_processes(struct process_reader *r)
+{
+    struct process_set ps = {.nprocesses = r->nprocesses};
+    ps.pid = malloc(ps.nprocesses * sizeof *ps.pid);
+    ps.arrival_time = malloc(ps.nprocesses * sizeof *ps.arrival_time);
+    ps.burst_time = malloc(ps.nprocesses * sizeof *ps.burst_time);
+    if (!ps.pid || !ps.arrival_time || !ps.burst_time)
     {
-        fprintf(stderr, "%s: zero quantum length\n", argv[0]);
-        return 1;
+        perror("malloc");
+        exit(1);
     }
 
-    struct process_list list;
-    TAILQ_INIT(&list);
+    for (long i = 0; i < ps.nprocesses; i++)
+    {
+        struct process p;
+        reader_next_process(r, &p);
+        ps.pid[i] = p.pid;
+        ps.arrival_time[i] = p.arrival_time;
+        ps.burst_time[i] = p.burst_time;
+    }
+    return ps;
+}
 
-    long total_wait_time = 0;
-    long total_response_time = 0;
+static void
+free_processes(struct process_set *ps)
+{
+    free(ps->pid);
+    free(ps->arrival_time);
+    free(ps->burst_time);
+}
 
-    /* Your code here */
-    struct process *cur, *cur_run, *prev_run = NULL;
+/* A process's arrival time and its position in the input.  */
+struct arrival_key
+{
+    long arrival_time;
+    long index;
+};
+
+/* Order arrival keys by arrival time, then by position in the input, so
+   that simultaneous arrivals keep the order in which they appear in the
+   input file.  */
+static int
+compare_arrival(void const *a, void const *b)
+{
+    struct arrival_key const *p = a;
+    struct arrival_key const *q = b;
 
-    bool use_median_quantum = (quantum_length == -1);
+    if (p->arrival_time != q->arrival_time)
+        return p->arrival_time < q->arrival_time ? -1 : 1;
+    return (p->index > q->index) - (p->index < q->index);
+}
 
-    // Initialize our additional fields
-    for (long i = 0; i < ps.nprocesses; i++)
+/* Store into V[I] the element of V at position KEY[I].INDEX, for each
+   I less than N, using TMP as scratch space.  */
+static void
+permute(long *v, long *tmp, struct arrival_key const *key, long n)
+{
+    for (long i = 0; i < n; i++)
+        tmp[i] = v[key[i].index];
+    memcpy(v, tmp, n * sizeof *v);
+}
+
+/* Reorder the processes in PS by arrival time, keeping processes that
+   arrive at the same time in input order.  Report an error and exit on
+   failure.  */
+static void
+sort_by_arrival(struct process_set *ps)
+{
+    long n = ps->nprocesses;
+    struct arrival_key *key = malloc(n * sizeof *key);
+    long *tmp = malloc(n * sizeof *tmp);
+    if (!key || !tmp)
     {
-        cur = &ps.process[i];
-        cur->rem_time = cur->burst_time;
-        cur->start_time = 0;
-        cur->end_time = 0;
-        cur->cpu_time = 0;
-        cur->ran_before = false;
+        perror("malloc");
+        exit(1);
     }
 
-    long cur_time = 0, cur_quant = 0, num_process_finished = 0;
-    bool finished = false, running = false;
+    for (long i = 0; i < n; i++)
+        key[i] = (struct arrival_key){ps->arrival_time[i], i};
+    qsort(key, n, sizeof *key, compare_arrival);
+    permute(ps->pid, tmp, key, n);
+    permute(ps->arrival_time, tmp, key, n);
+    permute(ps->burst_time, tmp, key, n);
 
-    // Base case: insert processes with arrival_time of 0 into the list
-    for (long i = 0; i < ps.nprocesses; i++)
+    free(key);
+    free(tmp);
+}
+
+/* A binary heap of processes in which no process is ABOVE its parent.
+   Each process records its own position in HEAP_INDEX, so that it can be
+   removed from anywhere in the heap.  */
+struct process_heap
+{
+    struct process **proc;
+    long count;
+    long alloc;
+    bool (*above)(struct process const *, struct process const *);
+};
+
+static void
+heap_init(struct process_heap *heap,
+          bool (*above)(struct process const *, struct process const *))
+{
+    *heap = (struct process_heap){NULL, 0, 0, above};
+}
+
+static void
+heap_set(struct process_heap *heap, long i, struct process *p)
+{
+    heap->proc[i] = p;
+    p->heap_index = i;
+}
+
+/* Restore the heap property of HEAP after its Ith entry changed.  */
+static void
+heap_fix(struct process_heap *heap, long i)
+{
+    struct process *p = heap->proc[i];
+
+    while (0 < i && heap->above(p, heap->proc[(i - 1) / 2]))
     {
-        cur = &ps.process[i];
-        if (cur->arrival_time == 0)
-            TAILQ_INSERT_TAIL(&list, cur, pointers);
+        heap_set(heap, i, heap->proc[(i - 1) / 2]);
+        i = (i - 1) / 2;
     }
 
-    while (!finished)
+    for (;;)
     {
-        // // print out all the processes in the TAILQ
-        // printf("Current time: %ld\n", cur_time);
-        // printf("Processes in the queue: ");
-        // // If nothing in the queue, print out "None" else print out the pid
-        // if (TAILQ_EMPTY(&list))
-        // {
-        //     printf("None\n");
-        // }
-        // else
-        // {
-        //     TAILQ_FOREACH(cur, &list, pointers)
-        //     {
-        //         printf("%ld ", cur->pid);
-        //     }
-        //     printf("\n");
-        // }
+        long child = 2 * i + 1;
+        if (heap->count <= child)
+            break;
+        if (child + 1 < heap->count
+            && heap->above(heap->proc[child + 1], heap->proc[child]))
+            child++;
+        if (!heap->above(heap->proc[child], p))
+            break;
+        heap_set(heap, i, heap->proc[child]);
+        i = child;
+    }
+
+    heap_set(heap, i, p);
+}
 
-        // If it is not running but the queue is not empty, start running
-        if (!running && !TAILQ_EMPTY(&list))
+/* Push process P onto HEAP, growing it as needed.  Report an error and
+   exit on failure.  */
+static void
+heap_push(struct process_heap *heap, struct process *p)
+{
+    if (heap->count == heap->alloc)
+    {
+        size_t size;
+        if (ckd_mul(&heap->alloc, heap->alloc + 1, 2)
+            || ckd_mul(&size, heap->alloc, sizeof *heap->proc))
+        {
+            fprintf(stderr, "heap too large\n");
+            exit(1);
+        }
+        heap->proc = realloc(heap->proc, size);
+        if (!heap->proc)
         {
-            cur_run = TAILQ_FIRST(&list);
+            perror("realloc");
+            exit(1);
+        }
+    }
+    heap_set(heap, heap->count++, p);
+    heap_fix(heap, heap->count - 1);
+}
 
-            if (use_median_quantum) // If we need to recalculate quantum length based on median
-            {
-                long values[ps.nprocesses];
-                long count = 0;
+/* Remove the Ith entry of HEAP and return it.  */
+static struct process *
+heap_remove(struct process_heap *heap, long i)
+{
+    struct process *p = heap->proc[i];
+    struct process *last = heap->proc[--heap->count];
 
-                // Collect CPU times of processes that are in the queue
-                TAILQ_FOREACH(cur, &list, pointers)
-                {
-                    values[count] = cur->cpu_time;
-                    count++;
-                }
+    if (i < heap->count)
+    {
+        heap_set(heap, i, last);
+        heap_fix(heap, i);
+    }
+    return p;
+}
+
+/* Return the CPU time process P has used so far.  */
+static long
+cpu_time(struct process const *p)
+{
+    return p->burst_time - p->rem_time;
+}
 
-                long new_quantum_length = 1; // Default value
+static bool
+more_cpu_time(struct process const *p, struct process const *q)
+{
+    return cpu_time(p) > cpu_time(q);
+}
 
-                if (count > 0)
-                {
-                    // sort the cpu times in ascending order
-                    for (long i = 0; i < count; i++)
-                    {
-                        for (long j = i + 1; j < count; j++)
-                        {
-                            if (values[i] > values[j])
-                            {
-                                long temp = values[i];
-                                values[i] = values[j];
-                                values[j] = temp;
-                            }
-                        }
-                    }
+static bool
+less_cpu_time(struct process const *p, struct process const *q)
+{
+    return cpu_time(p) < cpu_time(q);
+}
 
-                    // print values array
-                    // printf("CPU times: ");
-                    // for (long i = 0; i < count; i++)
-                    // {
-                    //     printf("%ld ", values[i]);
-                    // }
-                    // printf("\n");
+/* Order by remaining time, then by arrival.  */
+static bool
+less_rem_time(struct process const *p, struct process const *q)
+{
+    return p->rem_time != q->rem_time ? p->rem_time < q->rem_time : p->seq < q->seq;
+}
 
-                    // If there are an even number of processes, take the average of the two middle values
-                    if (count % 2 == 0)
-                    {
-                        new_quantum_length = (values[count / 2] + values[count / 2 - 1]) / 2;
+/* Order by virtual runtime, then by arrival.  */
+static bool
+less_vruntime(struct process const *p, struct process const *q)
+{
+    return p->vruntime != q->vruntime ? p->vruntime < q->vruntime : p->seq < q->seq;
+}
 
-                        // If the sum is odd, then take the ceiling of the average
-                        if ((values[count / 2] + values[count / 2 - 1]) % 2 != 0)
-                        {
-                            new_quantum_length++;
-                        }
-                    }
-                    else // If there are an odd number of processes, take the middle value
-                    {
-                        new_quantum_length = values[count / 2];
-                    }
+/* The round-robin ready queue: a FIFO of processes plus, when the
+   quantum is the median CPU time of the queued processes, that multiset
+   of CPU times split across two heaps.  LOW is a max-heap holding the
+   smaller half and HIGH a min-heap holding the larger half, with LOW
+   holding the extra process when the count is odd, so the median is
+   always at the top.  A process's CPU time cannot change while it is
+   queued, so pushing, popping and finding the median all take O(log n)
+   time.  The FIFO is a circular buffer of ALLOC slots, a power of two,
+   holding COUNT processes starting at slot HEAD.  */
+struct ready_queue
+{
+    struct process **ring;
+    long head, count, alloc;
+    bool track_median;
+    struct process_heap low, high;
+};
 
-                    // If the new quantum length is less than 1, set it to 1
-                    if (new_quantum_length < 1)
-                    {
-                        new_quantum_length = 1;
-                    }
-                }
+/* The number of MLFQ priority levels.  A process at level I runs for
+   slices of QUANTUM << I ticks and drops a level once it has used that
+   much CPU time at its level.  Every MLFQ_BOOST_QUANTA base quanta, all
+   processes return to the top level so that long jobs are not starved.  */
+#define MLFQ_LEVELS 3
+#define MLFQ_BOOST_QUANTA 50
 
-                quantum_length = new_quantum_length;
+/* A multi-level feedback queue.  A boost splices every level onto the
+   top one and bumps EPOCH; a process whose own epoch is out of date is
+   reset to the top level the next time the scheduler looks at it, so a
+   boost takes O(1) time however many processes it moves.  */
+struct mlfq
+{
+    struct process_list level[MLFQ_LEVELS];
+    long epoch;
+    long boost_period;
+    long next_boost;
+};
 
-                // printf("Median Quantum length: %ld\n", quantum_length);
-                // printf("\n");
-            }
+/* A CFS-style run queue: a left-leaning red-black tree of processes
+   keyed by virtual runtime, whose leftmost process runs next.
+   MIN_VRUNTIME never decreases; newly arriving processes start there so
+   that they cannot monopolize the CPU to catch up.  */
+struct cfs
+{
+    struct process *root;
+    long min_vruntime;
+};
 
-            // Check if the previous process and the new process are different
-            if (prev_run != NULL && prev_run != cur_run)
-            {
-                cur_time++; // Add context switch overhead
-                for (long i = 0; i < ps.nprocesses; i++)
-                {
-                    cur = &ps.process[i];
-                    if (cur->arrival_time == cur_time)
-                        TAILQ_INSERT_TAIL(&list, cur, pointers);
-                }
+struct policy;
 
-                // print out the context switch from prev_run to cur_run
-                // printf("Context switch from process %ld to process %ld\n", prev_run->pid, cur_run->pid);
-                //print current time
-                // printf("Current time: %ld\n", cur_time);
-            }
+/* The run queue of one simulated CPU.  */
+struct scheduler
+{
+    struct policy const *policy;
+    long quantum_length; /* Base time slice, or -1 for the median CPU time */
+    long now;            /* Current simulated time */
+    union
+    {
+        struct ready_queue rr;
+        struct process_heap srtf;
+        struct mlfq mlfq;
+        struct cfs cfs;
+    } u;
+};
 
-            prev_run = cur_run;
+/* A scheduling policy.  The simulator makes arriving and preempted
+   processes ready with ENQUEUE, asks PICK_NEXT for the next process to
+   dispatch, reports CPU time used through TICK, and asks PREEMPT
+   whether a newly arrived process should displace the running one.  */
+struct policy
+{
+    char const *name;
 
-            TAILQ_REMOVE(&list, cur_run, pointers);
+    void (*init)(struct scheduler *s);
+    void (*destroy)(struct scheduler *s);
 
-            if (!cur_run->ran_before)
-            {
-                cur_run->ran_before = true;
-                cur_run->start_time = cur_time;
-            }
+    /* Make process P ready to run.  */
+    void (*enqueue)(struct scheduler *s, struct process *p);
 
-            running = true;
-            cur_quant = 0;
-        }
+    /* Remove and return the next process to run and store into *SLICE
+       the most time it may run before it must give up the CPU.  Return
+       NULL if no process is ready.  */
+    struct process *(*pick_next)(struct scheduler *s, long *slice);
 
-        if (!running && TAILQ_EMPTY(&list)) {
-            prev_run = NULL;
-        }
+    /* Account for process P having just run for RAN ticks.  May be NULL.  */
+    void (*tick)(struct scheduler *s, struct process *p, long ran);
 
-        cur_time++;
+    /* Return true if process ARRIVED, which has just been enqueued,
+       should preempt the running process RUNNING.  NULL if arrivals
+       never preempt.  */
+    bool (*preempt)(struct scheduler *s, struct process *running,
+                    struct process *arrived);
+};
 
-        // Insert processes with arrival_time of cur_time into the list
-        if (running)
-        {
-            cur_quant++;
-            cur_run->rem_time--;
-            cur_run->cpu_time++;
+/* Round robin.  */
 
-            if (cur_run->rem_time == 0)
-            {
-                cur_run->end_time = cur_time;
-                num_process_finished++;
-                total_wait_time += cur_run->end_time - cur_run->arrival_time - cur_run->burst_time;
-                total_response_time += cur_run->start_time - cur_run->arrival_time;
-                running = false;
-                cur_quant = 0;
-            }
-            else if (cur_quant == quantum_length)
-            {
-                cur_quant = 0;
-                running = false;
-                TAILQ_INSERT_TAIL(&list, cur_run, pointers);
-            }
-        }
+static void
+rr_init(struct scheduler *s)
+{
+    struct ready_queue *ready = &s->u.rr;
+
+    ready->ring = NULL;
+    ready->head = ready->count = ready->alloc = 0;
+    ready->track_median = (s->quantum_length == -1);
+    if (ready->track_median)
+    {
+        heap_init(&ready->low, more_cpu_time);
+        heap_init(&ready->high, less_cpu_time);
+    }
+}
+
+static void
+rr_destroy(struct scheduler *s)
+{
+    free(s->u.rr.ring);
+    if (s->u.rr.track_median)
+    {
+        free(s->u.rr.low.proc);
+        free(s->u.rr.high.proc);
+    }
+}
+
+/* Move processes between the halves of READY's median heaps until LOW
+   holds as many processes as HIGH, or one more.  */
+static void
+median_rebalance(struct ready_queue *ready)
+{
+    struct process *p;
+
+    if (ready->low.count > ready->high.count + 1)
+    {
+        p = heap_remove(&ready->low, 0);
+        p->heap_low = false;
+        heap_push(&ready->high, p);
+    }
+    else if (ready->high.count > ready->low.count)
+    {
+        p = heap_remove(&ready->high, 0);
+        p->heap_low = true;
+        heap_push(&ready->low, p);
+    }
+}
+
+/* Return the median CPU time of the processes in READY, rounded up, or
+   1 if that would be less than 1.  READY must be tracking the median.  */
+static long
+median_quantum(struct ready_queue const *ready)
+{
+    long new_quantum_length = 1; // Default value
+
+    if (ready->low.count == 0)
+        return new_quantum_length;
+
+    long lower_middle = cpu_time(ready->low.proc[0]);
+
+    // If there are an even number of processes, take the average of the two middle values
+    if (ready->low.count == ready->high.count)
+    {
+        long upper_middle = cpu_time(ready->high.proc[0]);
+        new_quantum_length = (lower_middle + upper_middle) / 2;
 
-        for (long i = 0; i < ps.nprocesses; i++)
+        // If the sum is odd, then take the ceiling of the average
+        if ((lower_middle + upper_middle) % 2 != 0)
         {
-            cur = &ps.process[i];
-            if (cur->arrival_time == cur_time)
-                TAILQ_INSERT_TAIL(&list, cur, pointers);
+            new_quantum_length++;
         }
+    }
+    else // If there are an odd number of processes, take the middle value
+    {
+        new_quantum_length = lower_middle;
+    }
 
-        if (num_process_finished == ps.nprocesses)
-            finished = true;
+    // If the new quantum length is less than 1, set it to 1
+    if (new_quantum_length < 1)
+    {
+        new_quantum_length = 1;
     }
 
-    // printf("\n");
-    // for (long i = 0; i < ps.nprocesses; i++)
-    // {
-    //     cur = &ps.process[i];
-    //     printf("Process %ld\n", cur->pid);
-    //     printf("  arrival time: %ld\n", cur->arrival_time);
-    //     printf("  burst time: %ld\n", cur->burst_time);
-    //     printf("  start time: %ld\n", cur->start_time);
-    //     printf("  end time: %ld\n", cur->end_time);
-    //     printf("  turnaround time: %ld\n", cur->end_time - cur->arrival_time);
-    //     printf("  wait time: %ld\n", cur->end_time - cur->arrival_time - cur->burst_time);
-    //     printf("  response time: %ld\n", cur->start_time - cur->arrival_time);
-    //     printf("\n");
-    // }
-    /* End of "Your code here" */
+    return new_quantum_length;
+}
 
-    // print all process statistics
+/* Double the number of slots in READY's circular buffer, moving the
+   processes that wrapped around to the start of the old buffer to just
+   past its end.  Report an error and exit on failure.  */
+static void
+ring_grow(struct ready_queue *ready)
+{
+    long alloc;
+    size_t size;
+    if (ckd_mul(&alloc, ready->alloc ? ready->alloc : 8, 2)
+        || ckd_mul(&size, alloc, sizeof *ready->ring))
+    {
+        fprintf(stderr, "ready queue too large\n");
+        exit(1);
+    }
+    ready->ring = realloc(ready->ring, size);
+    if (!ready->ring)
+    {
+        perror("realloc");
+        exit(1);
+    }
+
+    long wrapped = ready->head + ready->count - ready->alloc;
+    if (0 < wrapped)
+        memcpy(ready->ring + ready->alloc, ready->ring,
+               wrapped * sizeof *ready->ring);
+    ready->alloc = alloc;
+}
+
+static void
+rr_enqueue(struct scheduler *s, struct process *p)
+{
+    struct ready_queue *ready = &s->u.rr;
+
+    if (ready->count == ready->alloc)
+        ring_grow(ready);
+    ready->ring[(ready->head + ready->count++) & (ready->alloc - 1)] = p;
+    if (!ready->track_median)
+        return;
+
+    p->heap_low = (ready->low.count == 0
+                   || cpu_time(p) <= cpu_time(ready->low.proc[0]));
+    heap_push(p->heap_low ? &ready->low : &ready->high, p);
+    median_rebalance(ready);
+}
+
+static struct process *
+rr_pick_next(struct scheduler *s, long *slice)
+{
+    struct ready_queue *ready = &s->u.rr;
+    if (ready->count == 0)
+        return NULL;
+    struct process *p = ready->ring[ready->head];
 
-    printf("Average wait time: %.2f\n",
-           total_wait_time / (double)ps.nprocesses);
-    printf("Average response time: %.2f\n",
-           total_response_time / (double)ps.nprocesses);
+    // The median includes the process about to be dispatched
+    *slice = ready->track_median ? median_quantum(ready) : s->quantum_length;
+
+    ready->head = (ready->head + 1) & (ready->alloc - 1);
+    ready->count--;
+    if (ready->track_median)
+    {
+        heap_remove(p->heap_low ? &ready->low : &ready->high, p->heap_index);
+        median_rebalance(ready);
+    }
+    return p;
+}
+
+/* Shortest remaining time first: always run the process closest to
+   completion, preempting it whenever a shorter process arrives.  */
+
+static void
+srtf_init(struct scheduler *s)
+{
+    heap_init(&s->u.srtf, less_rem_time);
+}
+
+static void
+srtf_destroy(struct scheduler *s)
+{
+    free(s->u.srtf.proc);
+}
+
+static void
+srtf_enqueue(struct scheduler *s, struct process *p)
+{
+    heap_push(&s->u.srtf, p);
+}
+
+static struct process *
+srtf_pick_next(struct scheduler *s, long *slice)
+{
+    if (s->u.srtf.count == 0)
+        return NULL;
+    *slice = LONG_MAX;
+    return heap_remove(&s->u.srtf, 0);
+}
+
+static bool
+srtf_preempt(struct scheduler *s, struct process *running,
+             struct process *arrived)
+{
+    (void)s;
+    return arrived->rem_time < running->rem_time;
+}
+
+/* Multi-level feedback queue.  */
+
+static void
+mlfq_init(struct scheduler *s)
+{
+    struct mlfq *mlfq = &s->u.mlfq;
+
+    for (int i = 0; i < MLFQ_LEVELS; i++)
+        TAILQ_INIT(&mlfq->level[i]);
+    mlfq->epoch = 0;
+    if (ckd_mul(&mlfq->boost_period, s->quantum_length, MLFQ_BOOST_QUANTA))
+        mlfq->boost_period = LONG_MAX;
+    mlfq->next_boost = mlfq->boost_period;
+}
+
+static void
+mlfq_destroy(struct scheduler *s)
+{
+    (void)s;
+}
+
+/* Return the CPU time a process may use at LEVEL before dropping to
+   the next level.  */
+static long
+mlfq_allotment(struct scheduler const *s, int level)
+{
+    long allotment;
+    if (ckd_mul(&allotment, s->quantum_length, 1L << level))
+        allotment = LONG_MAX;
+    return allotment;
+}
+
+/* Bring process P up to date with the priority boosts so far.  */
+static void
+mlfq_refresh(struct mlfq const *mlfq, struct process *p)
+{
+    if (p->mlfq_epoch != mlfq->epoch)
+    {
+        p->mlfq_epoch = mlfq->epoch;
+        p->mlfq_level = 0;
+        p->mlfq_used = 0;
+    }
+}
+
+static void
+mlfq_enqueue(struct scheduler *s, struct process *p)
+{
+    struct mlfq *mlfq = &s->u.mlfq;
+
+    if (!p->ran_before)
+    {
+        p->mlfq_epoch = mlfq->epoch;
+        p->mlfq_level = 0;
+        p->mlfq_used = 0;
+    }
+    mlfq_refresh(mlfq, p);
+    TAILQ_INSERT_TAIL(&mlfq->level[p->mlfq_level], p, pointers);
+}
+
+static struct process *
+mlfq_pick_next(struct scheduler *s, long *slice)
+{
+    struct mlfq *mlfq = &s->u.mlfq;
+
+    if (mlfq->next_boost <= s->now)
+    {
+        for (int i = 1; i < MLFQ_LEVELS; i++)
+            TAILQ_CONCAT(&mlfq->level[0], &mlfq->level[i], pointers);
+        mlfq->epoch++;
+        while (mlfq->next_boost <= s->now)
+            if (ckd_add(&mlfq->next_boost, mlfq->next_boost, mlfq->boost_period))
+                mlfq->next_boost = LONG_MAX;
+    }
+
+    for (int i = 0; i < MLFQ_LEVELS; i++)
+    {
+        struct process *p = TAILQ_FIRST(&mlfq->level[i]);
+        if (p)
+        {
+            TAILQ_REMOVE(&mlfq->level[i], p, pointers);
+            mlfq_refresh(mlfq, p);
+            *slice = mlfq_allotment(s, p->mlfq_level) - p->mlfq_used;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void
+mlfq_tick(struct scheduler *s, struct process *p, long ran)
+{
+    mlfq_refresh(&s->u.mlfq, p);
+    p->mlfq_used += ran;
+    if (mlfq_allotment(s, p->mlfq_level) <= p->mlfq_used)
+    {
+        if (p->mlfq_level < MLFQ_LEVELS - 1)
+            p->mlfq_level++;
+        p->mlfq_used = 0;
+    }
+}
+
+static bool
+mlfq_preempt(struct scheduler *s, struct process *running,
+             struct process *arrived)
+{
+    mlfq_refresh(&s->u.mlfq, running);
+    return arrived->mlfq_level < running->mlfq_level;
+}
+
+/* Completely fair scheduling, with every process at the same weight so
+   that virtual runtime is simply CPU time since arrival plus the
+   MIN_VRUNTIME the process started at.  */
+
+static bool
+rb_red(struct process const *h)
+{
+    return h && h->rb_red;
+}
+
+static struct process *
+rb_rotate_left(struct process *h)
+{
+    struct process *x = h->rb_right;
+    h->rb_right = x->rb_left;
+    x->rb_left = h;
+    x->rb_red = h->rb_red;
+    h->rb_red = true;
+    return x;
+}
+
+static struct process *
+rb_rotate_right(struct process *h)
+{
+    struct process *x = h->rb_left;
+    h->rb_left = x->rb_right;
+    x->rb_right = h;
+    x->rb_red = h->rb_red;
+    h->rb_red = true;
+    return x;
+}
+
+static void
+rb_flip_colors(struct process *h)
+{
+    h->rb_red = !h->rb_red;
+    h->rb_left->rb_red = !h->rb_left->rb_red;
+    h->rb_right->rb_red = !h->rb_right->rb_red;
+}
+
+/* Restore the left-leaning red-black invariants at H on the way back up
+   from an insertion or deletion, and return the new subtree root.  */
+static struct process *
+rb_fix_up(struct process *h)
+{
+    if (rb_red(h->rb_right))
+        h = rb_rotate_left(h);
+    if (rb_red(h->rb_left) && rb_red(h->rb_left->rb_left))
+        h = rb_rotate_right(h);
+    if (rb_red(h->rb_left) && rb_red(h->rb_right))
+        rb_flip_colors(h);
+    return h;
+}
+
+static struct process *
+rb_insert(struct process *h, struct process *p)
+{
+    if (!h)
+    {
+        p->rb_left = p->rb_right = NULL;
+        p->rb_red = true;
+        return p;
+    }
+
+    if (less_vruntime(p, h))
+        h->rb_left = rb_insert(h->rb_left, p);
+    else
+        h->rb_right = rb_insert(h->rb_right, p);
+    return rb_fix_up(h);
+}
+
+/* Delete the leftmost process of the subtree rooted at H, and return the
+   new subtree root.  */
+static struct process *
+rb_delete_min(struct process *h)
+{
+    if (!h->rb_left)
+        return NULL;
+
+    if (!rb_red(h->rb_left) && !rb_red(h->rb_left->rb_left))
+    {
+        rb_flip_colors(h);
+        if (rb_red(h->rb_right->rb_left))
+        {
+            h->rb_right = rb_rotate_right(h->rb_right);
+            h = rb_rotate_left(h);
+            rb_flip_colors(h);
+        }
+    }
+
+    h->rb_left = rb_delete_min(h->rb_left);
+    return rb_fix_up(h);
+}
+
+static void
+cfs_init(struct scheduler *s)
+{
+    s->u.cfs.root = NULL;
+    s->u.cfs.min_vruntime = 0;
+}
+
+static void
+cfs_destroy(struct scheduler *s)
+{
+    (void)s;
+}
+
+static void
+cfs_enqueue(struct scheduler *s, struct process *p)
+{
+    struct cfs *cfs = &s->u.cfs;
+
+    if (!p->ran_before)
+        p->vruntime = cfs->min_vruntime;
+    cfs->root = rb_insert(cfs->root, p);
+    cfs->root->rb_red = false;
+}
+
+static struct process *
+cfs_pick_next(struct scheduler *s, long *slice)
+{
+    struct cfs *cfs = &s->u.cfs;
+    struct process *p = cfs->root;
+    if (!p)
+        return NULL;
+
+    while (p->rb_left)
+        p = p->rb_left;
+
+    if (!rb_red(cfs->root->rb_left) && !rb_red(cfs->root->rb_right))
+        cfs->root->rb_red = true;
+    cfs->root = rb_delete_min(cfs->root);
+    if (cfs->root)
+        cfs->root->rb_red = false;
+
+    if (cfs->min_vruntime < p->vruntime)
+        cfs->min_vruntime = p->vruntime;
+    *slice = s->quantum_length;
+    return p;
+}
+
+static void
+cfs_tick(struct scheduler *s, struct process *p, long ran)
+{
+    (void)s;
+    p->vruntime += ran;
+}
+
+static struct policy const policies[] = {
+    {"rr", rr_init, rr_destroy, rr_enqueue, rr_pick_next, NULL, NULL},
+    {"srtf", srtf_init, srtf_destroy, srtf_enqueue, srtf_pick_next, NULL,
+     srtf_preempt},
+    {"mlfq", mlfq_init, mlfq_destroy, mlfq_enqueue, mlfq_pick_next,
+     mlfq_tick, mlfq_preempt},
+    {"cfs", cfs_init, cfs_destroy, cfs_enqueue, cfs_pick_next, cfs_tick,
+     NULL},
+};
+
+/* Return the policy named NAME, or NULL if there is none.  */
+static struct policy const *
+find_policy(char const *name)
+{
+    for (size_t i = 0; i < sizeof policies / sizeof *policies; i++)
+        if (strcmp(policies[i].name, name) == 0)
+            return &policies[i];
+    return NULL;
+}
+
+/* Where a simulation gets its arrivals: either PS, a process set sorted
+   by arrival time, or else READER, a process file streamed as the
+   simulation goes.  A streamed file must list processes in order of
+   arrival; if it does not, UNSORTED is set and the simulation gives up
+   so that the caller can sort the file and start over.  */
+struct arrival_source
+{
+    long nprocesses;     /* Or -1 to read until the end of the file */
+    struct process_set const *ps;
+    struct process_reader *reader;
+    long next;           /* Number of processes taken so far */
+    struct process peeked;
+    bool have_peeked;    /* Whether PEEKED holds process NEXT */
+    bool unsorted;
+};
+
+/* Return the next process to arrive from SRC without taking it, or NULL
+   if there is none left or SRC turned out to be unsorted.  */
+static struct process const *
+source_peek(struct arrival_source *src)
+{
+    if (src->next == src->nprocesses || src->unsorted)
+        return NULL;
+    if (src->ps)
+    {
+        src->peeked.pid = src->ps->pid[src->next];
+        src->peeked.arrival_time = src->ps->arrival_time[src->next];
+        src->peeked.burst_time = src->ps->burst_time[src->next];
+    }
+    else if (!src->have_peeked)
+    {
+        if (src->nprocesses == -1 && reader_at_end(src->reader))
+            return NULL;
+
+        long last = src->peeked.arrival_time;
+        reader_next_process(src->reader, &src->peeked);
+        src->have_peeked = true;
+        if (src->next != 0 && src->peeked.arrival_time < last)
+        {
+            src->unsorted = true;
+            return NULL;
+        }
+    }
+    return &src->peeked;
+}
+
+static void
+source_take(struct arrival_source *src)
+{
+    src->next++;
+    src->have_peeked = false;
+}
+
+/* Processes are allocated this many at a time.  */
+#define POOL_SLAB 4096
+
+struct pool_slab
+{
+    struct pool_slab *next;
+    struct process process[POOL_SLAB];
+};
+
+/* A pool of process table entries.  Only processes that have arrived and
+   not yet completed need an entry, so entries are recycled through FREE
+   and a simulation's memory is bounded by how many processes are in the
+   system at once rather than by the length of the input.  */
+struct process_pool
+{
+    struct pool_slab *slabs; /* Newest slab first */
+    long used;               /* Entries handed out from the newest slab */
+    struct process *free;    /* Recycled entries, linked by NEXT_FREE */
+};
+
+static void
+pool_init(struct process_pool *pool)
+{
+    pool->slabs = NULL;
+    pool->used = POOL_SLAB;
+    pool->free = NULL;
+}
+
+/* Return an unused process table entry from POOL.  Report an error and
+   exit on failure.  */
+static struct process *
+pool_alloc(struct process_pool *pool)
+{
+    struct process *p = pool->free;
+    if (p)
+    {
+        pool->free = p->next_free;
+        return p;
+    }
+
+    if (pool->used == POOL_SLAB)
+    {
+        struct pool_slab *slab = malloc(sizeof *slab);
+        if (!slab)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->used = 0;
+    }
+    return &pool->slabs->process[pool->used++];
+}
+
+static void
+pool_free(struct process_pool *pool, struct process *p)
+{
+    p->next_free = pool->free;
+    pool->free = p;
+}
+
+static void
+pool_destroy(struct process_pool *pool)
+{
+    while (pool->slabs)
+    {
+        struct pool_slab *slab = pool->slabs;
+        pool->slabs = slab->next;
+        free(slab);
+    }
+}
+
+/* Sketches bucket values exactly below SKETCH_SUB, and above that by
+   their SKETCH_SUB_BITS leading bits, so that a quantile read from a
+   sketch is within 1 / SKETCH_SUB of the exact one.  */
+#define SKETCH_SUB_BITS 7
+#define SKETCH_SUB (1L << SKETCH_SUB_BITS)
+#define SKETCH_BUCKETS (SKETCH_SUB + (63 - SKETCH_SUB_BITS) * SKETCH_SUB)
+
+/* A streaming quantile sketch of nonnegative times: a log-linear
+   histogram, so that adding a time takes O(1) time and the memory used
+   does not depend on how many times are added.  */
+struct sketch
+{
+    long count;
+    long max;
+    long bucket[SKETCH_BUCKETS];
+};
+
+/* Return a newly allocated empty sketch.  Report an error and exit on
+   failure.  */
+static struct sketch *
+sketch_new(void)
+{
+    struct sketch *sk = calloc(1, sizeof *sk);
+    if (!sk)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    return sk;
+}
+
+static long
+sketch_bucket(long v)
+{
+    if (v < SKETCH_SUB)
+        return v;
+    int shift = 63 - __builtin_clzl(v) - SKETCH_SUB_BITS;
+    return (shift + 1) * SKETCH_SUB + ((v >> shift) - SKETCH_SUB);
+}
+
+/* Return the largest value that falls in bucket B.  */
+static long
+sketch_bucket_max(long b)
+{
+    if (b < SKETCH_SUB)
+        return b;
+    int shift = b / SKETCH_SUB - 1;
+    long mantissa = SKETCH_SUB + b % SKETCH_SUB;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static void
+sketch_clear(struct sketch *sk)
+{
+    memset(sk, 0, sizeof *sk);
+}
+
+static void
+sketch_add(struct sketch *sk, long v)
+{
+    sk->bucket[sketch_bucket(v)]++;
+    sk->count++;
+    if (sk->max < v)
+        sk->max = v;
+}
+
+/* Return the Q quantile (0 < Q <= 1) of the values in SK, by nearest
+   rank, or 0 if SK is empty.  */
+static long
+sketch_quantile(struct sketch const *sk, double q)
+{
+    long rank = (long)(q * sk->count);
+    if (rank < q * sk->count)
+        rank++;
+    if (rank < 1)
+        rank = 1;
+
+    long seen = 0;
+    for (long b = 0; b < SKETCH_BUCKETS; b++)
+    {
+        seen += sk->bucket[b];
+        if (rank <= seen)
+        {
+            long v = sketch_bucket_max(b);
+            return v < sk->max ? v : sk->max;
+        }
+    }
+    return 0;
+}
+
+/* Trace records are buffered this many at a time.  */
+#define TRACE_BUFFER 4096
+
+/* A schedule trace being written to the file named NAME.  */
+struct trace
+{
+    char const *name;
+    int fd;
+    long ncpus;
+    long count; /* Number of records in BUF */
+    struct trace_record buf[TRACE_BUFFER];
+};
+
+/* Write the N bytes at BUF to TRACE's file.  Report an error and exit
+   on failure.  */
+static void
+trace_write(struct trace *trace, void const *buf, size_t n)
+{
+    char const *p = buf;
+    while (n != 0)
+    {
+        ssize_t written = write(trace->fd, p, n);
+        if (written < 0)
+        {
+            perror(trace->name);
+            exit(1);
+        }
+        p += written;
+        n -= written;
+    }
+}
+
+static void
+trace_flush(struct trace *trace)
+{
+    trace_write(trace, trace->buf, trace->count * sizeof *trace->buf);
+    trace->count = 0;
+}
+
+/* Write the header that starts TRACE's file.  */
+static void
+trace_start(struct trace *trace)
+{
+    struct trace_header header = {TRACE_MAGIC, TRACE_VERSION, trace->ncpus};
+
+    trace->count = 0;
+    trace_write(trace, &header, sizeof header);
+}
+
+/* Empty TRACE's file, which must be a regular file, and start it over.  */
+static void
+trace_restart(struct trace *trace)
+{
+    if (ftruncate(trace->fd, 0) < 0 || lseek(trace->fd, 0, SEEK_SET) < 0)
+    {
+        perror(trace->name);
+        exit(1);
+    }
+    trace_start(trace);
+}
+
+/* Return a trace of a simulation of NCPUS CPUs, written to a file named
+   NAME.  Report an error and exit on failure.  */
+static struct trace *
+trace_open(char const *name, long ncpus)
+{
+    struct trace *trace = malloc(sizeof *trace);
+    if (!trace)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    trace->name = name;
+    trace->ncpus = ncpus;
+    trace->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (trace->fd < 0)
+    {
+        perror(name);
+        exit(1);
+    }
+    trace_start(trace);
+    return trace;
+}
+
+/* Return true if FD is a regular file, which can be emptied and written
+   over again.  */
+static bool
+is_regular_file(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static void
+trace_close(struct trace *trace)
+{
+    trace_flush(trace);
+    if (close(trace->fd) < 0)
+    {
+        perror(trace->name);
+        exit(1);
+    }
+    free(trace);
+}
+
+static void
+trace_event(struct trace *trace, enum trace_kind kind, long time, long cpu,
+            struct process const *p, long arg)
+{
+    if (trace->count == TRACE_BUFFER)
+        trace_flush(trace);
+    trace->buf[trace->count++] = (struct trace_record){time, p->pid, arg, cpu, kind};
+}
+
+/* Per-CPU totals accumulated by one simulation.  */
+struct cpu_stats
+{
+    long busy_time;   /* Time spent running processes */
+    long switch_time; /* Time spent switching between processes */
+    long dispatches;  /* Number of times a process was dispatched */
+    long steals;      /* Number of processes stolen from other CPUs */
+};
+
+/* Totals accumulated by one simulation.  */
+struct schedule_stats
+{
+    long total_wait_time;
+    long total_response_time;
+    long end_time;          /* When the last process completed */
+    long migrations;        /* Dispatches on a CPU other than the last one */
+    struct cpu_stats *cpu;  /* Vector of NCPUS per-CPU totals */
+
+    /* Distributions of per-process times, or null if not wanted */
+    struct sketch *wait, *response, *turnaround;
+};
+
+/* How to simulate a process set.  */
+struct sim_config
+{
+    struct policy const *policy;
+    long quantum_length; /* Base time slice, or -1 for the median CPU time */
+    long ncpus;          /* Number of CPUs, each with its own run queue */
+    long switch_cost;    /* Time to switch a CPU between processes */
+    bool percentiles;    /* Whether to sketch per-process times */
+    FILE *csv;           /* Where to list each completed process, or null */
+    struct trace *trace; /* Where to record scheduling events, or null */
+    long report_interval; /* How often to print rolling metrics, or 0 */
+};
+
+/* A simulated CPU with its own run queue.  */
+struct cpu
+{
+    struct scheduler s;
+    long nqueued;             /* Number of processes in the run queue */
+    struct process *running;  /* Process dispatched here, or NULL if idle */
+    long prev_seq;            /* SEQ of the last process run here, or -1
+                                 after idling */
+    long run_start;           /* When RUNNING was last accounted for */
+    long switch_end;          /* When RUNNING started running after a switch */
+    bool pending;             /* Whether this CPU must make a scheduling decision */
+    bool preempt;             /* Whether an arrival is to preempt RUNNING */
+};
+
+/* The state of one simulation.  Each CPU that must make a scheduling
+   decision at the current time is listed in PENDING, and each running
+   process is in RUNNING, a heap ordered by when its slice ends.  */
+struct sim
+{
+    struct sim_config const *config;
+    struct schedule_stats stats;
+    struct cpu *cpu;
+    long *pending;
+    long npending;
+    struct process_heap running;
+    struct process_pool pool;
+    long arrived;  /* Number of processes that have arrived */
+    long finished; /* Number of processes completed */
+    long now;
+
+    /* The processes completed since the last rolling report, if any */
+    long next_report; /* When the next report is due */
+    long window_completed;
+    long window_wait_time, window_response_time;
+    struct sketch *window_wait, *window_response;
+};
+
+/* Order running processes by the end of their slices, then by CPU.  */
+static bool
+ends_first(struct process const *p, struct process const *q)
+{
+    return (p->slice_end != q->slice_end ? p->slice_end < q->slice_end
+                                         : p->cpu < q->cpu);
+}
+
+static void
+cpu_enqueue(struct sim *sim, struct cpu *c, struct process *p)
+{
+    c->s.now = sim->now;
+    c->s.policy->enqueue(&c->s, p);
+    c->nqueued++;
+}
+
+/* Note that CPU C must make a scheduling decision at the current time.  */
+static void
+cpu_set_pending(struct sim *sim, struct cpu *c)
+{
+    if (!c->pending)
+    {
+        c->pending = true;
+        sim->pending[sim->npending++] = c - sim->cpu;
+    }
+}
+
+/* Charge the running process of CPU C for the time it has run since it
+   was last accounted for.  */
+static void
+cpu_account(struct sim *sim, struct cpu *c)
+{
+    struct process *p = c->running;
+    long ran = sim->now - c->run_start;
+
+    if (ran <= 0)
+        return;
+    p->rem_time -= ran;
+    sim->stats.cpu[p->cpu].busy_time += ran;
+    c->run_start = sim->now;
+    c->s.now = sim->now;
+    if (c->s.policy->tick)
+        c->s.policy->tick(&c->s, p, ran);
+}
+
+/* Account for process P completing at the current time.  */
+static void
+complete(struct sim *sim, struct process *p)
+{
+    struct schedule_stats *stats = &sim->stats;
+    long turnaround = sim->now - p->arrival_time;
+    long wait = turnaround - p->burst_time;
+    long response = p->start_time - p->arrival_time;
+
+    stats->end_time = sim->now;
+    stats->total_wait_time += wait;
+    stats->total_response_time += response;
+    sim->finished++;
+
+    if (stats->wait)
+    {
+        sketch_add(stats->wait, wait);
+        sketch_add(stats->response, response);
+        sketch_add(stats->turnaround, turnaround);
+    }
+    if (sim->config->csv)
+        fprintf(sim->config->csv, "%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%d\n",
+                p->pid, p->arrival_time, p->burst_time, p->start_time,
+                sim->now, wait, response, turnaround, p->cpu);
+    if (sim->window_wait)
+    {
+        sim->window_completed++;
+        sim->window_wait_time += wait;
+        sim->window_response_time += response;
+        sketch_add(sim->window_wait, wait);
+        sketch_add(sim->window_response, response);
+    }
+}
+
+static void
+report_header(void)
+{
+    printf("%10s  %9s  %9s  %9s  %12s  %8s  %12s\n", "Time", "Completed",
+           "In system", "Avg wait", "Avg response", "p99 wait", "p99 response");
+}
+
+/* Print the metrics of the processes completed since the last report,
+   labeled with TIME, and start a new window.  */
+static void
+report(struct sim *sim, long time)
+{
+    long n = sim->window_completed;
+
+    printf("%10ld  %9ld  %9ld  %9.2f  %12.2f  %8ld  %12ld\n", time, n,
+           sim->arrived - sim->finished,
+           n ? sim->window_wait_time / (double)n : 0,
+           n ? sim->window_response_time / (double)n : 0,
+           sketch_quantile(sim->window_wait, 0.99),
+           sketch_quantile(sim->window_response, 0.99));
+    if (fflush(stdout) < 0)
+    {
+        perror("stdout");
+        exit(1);
+    }
+
+    sim->window_completed = sim->window_wait_time = sim->window_response_time = 0;
+    sketch_clear(sim->window_wait);
+    sketch_clear(sim->window_response);
+}
+
+/* Take the running process off CPU C, which is being preempted if
+   C->PREEMPT is set.  The process completes and releases its table
+   entry if it has no time left, and goes back in C's run queue
+   otherwise.  The caller must make sure C then makes a scheduling
+   decision.  */
+static void
+cpu_stop(struct sim *sim, struct cpu *c)
+{
+    struct process *p = c->running;
+
+    cpu_account(sim, c);
+    c->running = NULL;
+
+    if (sim->config->trace)
+        trace_event(sim->config->trace,
+                    (p->rem_time == 0 ? TRACE_COMPLETE
+                     : c->preempt     ? TRACE_PREEMPT
+                                      : TRACE_EXPIRE),
+                    sim->now, c - sim->cpu, p, p->rem_time);
+
+    if (p->rem_time == 0)
+    {
+        complete(sim, p);
+        pool_free(&sim->pool, p);
+    }
+    else
+    {
+        cpu_enqueue(sim, c, p);
+    }
+}
+
+/* Return the CPU with the fewest running and queued processes.  */
+static struct cpu *
+least_loaded(struct sim *sim)
+{
+    struct cpu *best = sim->cpu;
+    long best_load = LONG_MAX;
+
+    for (long i = 0; i < sim->config->ncpus; i++)
+    {
+        struct cpu *c = &sim->cpu[i];
+        long load = c->nqueued + (c->running != NULL);
+        if (load < best_load)
+        {
+            best = c;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+/* Move a process into the empty run queue of CPU THIEF from the longest
+   run queue, if any process is waiting anywhere.  */
+static void
+cpu_steal(struct sim *sim, struct cpu *thief)
+{
+    struct cpu *victim = NULL;
+
+    for (long i = 0; i < sim->config->ncpus; i++)
+        if (sim->cpu[i].nqueued > (victim ? victim->nqueued : 0))
+            victim = &sim->cpu[i];
+    if (!victim)
+        return;
+
+    long slice;
+    victim->s.now = sim->now;
+    struct process *p = victim->s.policy->pick_next(&victim->s, &slice);
+    victim->nqueued--;
+    cpu_enqueue(sim, thief, p);
+    sim->stats.cpu[thief - sim->cpu].steals++;
+}
+
+/* Dispatch the next process in the run queue of the idle CPU C, first
+   stealing one from another CPU if C has none.  */
+static void
+cpu_dispatch(struct sim *sim, struct cpu *c)
+{
+    long index = c - sim->cpu;
+    struct cpu_stats *cs = &sim->stats.cpu[index];
+
+    if (c->nqueued == 0)
+        cpu_steal(sim, c);
+
+    // If nothing is ready the CPU idles until something arrives, and
+    // no context switch is charged when it wakes up again
+    long slice;
+    c->s.now = sim->now;
+    struct process *p = c->s.policy->pick_next(&c->s, &slice);
+    if (!p)
+    {
+        c->prev_seq = -1;
+        return;
+    }
+    c->nqueued--;
+
+    // Check if the previous process and the new process are different
+    long start = sim->now;
+    if (c->prev_seq != -1 && c->prev_seq != p->seq)
+    {
+        start += sim->config->switch_cost; // Add context switch overhead
+        cs->switch_time += sim->config->switch_cost;
+        if (sim->config->trace)
+            trace_event(sim->config->trace, TRACE_SWITCH, sim->now, index, p,
+                        sim->config->switch_cost);
+    }
+    c->prev_seq = p->seq;
+
+    if (!p->ran_before)
+    {
+        p->ran_before = true;
+        p->start_time = start;
+    }
+    else if (p->cpu != index)
+        sim->stats.migrations++;
+    p->cpu = index;
+
+    // Run until the slice expires or the process completes
+    if (p->rem_time < slice)
+        slice = p->rem_time;
+    if (ckd_add(&p->slice_end, start, slice))
+    {
+        fprintf(stderr, "time overflow\n");
+        exit(1);
+    }
+
+    c->running = p;
+    c->run_start = c->switch_end = start;
+    if (sim->config->trace)
+        trace_event(sim->config->trace, TRACE_DISPATCH, start, index, p, slice);
+    heap_push(&sim->running, p);
+    cs->dispatches++;
+}
+
+/* Simulate scheduling the processes from SRC as CONFIG describes.
+   Several simulations may run concurrently on sources sharing the same
+   process set, which is only read.  If SRC turns out to be unsorted the
+   simulation stops early and its results are meaningless.  The caller
+   must free the results with free_stats.  */
+static struct schedule_stats
+simulate(struct arrival_source *src, struct sim_config const *config)
+{
+    struct sim sim = {.config = config};
+    struct policy const *policy = config->policy;
+
+    /* Your code here */
+    struct process *cur;
+    struct process const *arrival;
+
+    sim.cpu = calloc(config->ncpus, sizeof *sim.cpu);
+    sim.stats.cpu = calloc(config->ncpus, sizeof *sim.stats.cpu);
+    sim.pending = malloc(config->ncpus * sizeof *sim.pending);
+    if (!sim.cpu || !sim.stats.cpu || !sim.pending)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    if (config->percentiles)
+    {
+        sim.stats.wait = sketch_new();
+        sim.stats.response = sketch_new();
+        sim.stats.turnaround = sketch_new();
+    }
+    if (config->report_interval)
+    {
+        sim.next_report = config->report_interval;
+        sim.window_wait = sketch_new();
+        sim.window_response = sketch_new();
+        report_header();
+    }
+
+    for (long i = 0; i < config->ncpus; i++)
+    {
+        sim.cpu[i].s = (struct scheduler){.policy = policy,
+                                          .quantum_length = config->quantum_length};
+        sim.cpu[i].prev_seq = -1;
+        policy->init(&sim.cpu[i].s);
+    }
+    heap_init(&sim.running, ends_first);
+    pool_init(&sim.pool);
+
+    /* Rather than advancing one tick at a time, jump straight from one
+       event (slice expiry, completion or arrival) to the next.  At each
+       event, processes whose slices end are stopped first, then arriving
+       processes are enqueued in input order, and then every CPU that
+       became free makes a scheduling decision.  So a process whose
+       quantum expires is enqueued ahead of processes arriving at that
+       very tick, exactly as a tick-by-tick scan would.  Context switches
+       are not preemptible: a process arriving during one that should
+       preempt the process being switched in cuts its slice short to end
+       with the switch, so that it is preempted as soon as it starts.  */
+    while (!src->unsorted && (sim.finished < sim.arrived || source_peek(src)))
+    {
+        // Report on the processes completed before the latest multiple
+        // of the report interval, if that has passed
+        if (sim.next_report && sim.next_report <= sim.now)
+        {
+            long interval = config->report_interval;
+            report(&sim, sim.now / interval * interval);
+            if (ckd_mul(&sim.next_report, sim.now / interval + 1, interval))
+                sim.next_report = LONG_MAX;
+        }
+
+        // Stop the processes whose slices end now
+        while (sim.running.count != 0 && sim.running.proc[0]->slice_end == sim.now)
+        {
+            struct cpu *c = &sim.cpu[heap_remove(&sim.running, 0)->cpu];
+            cpu_stop(&sim, c);
+            c->preempt = false;
+            cpu_set_pending(&sim, c);
+        }
+
+        // Enqueue each process arriving now on the least loaded CPU,
+        // noting whether it should preempt the process running there
+        while ((arrival = source_peek(src)) && arrival->arrival_time == sim.now)
+        {
+            // Initialize our additional fields
+            cur = pool_alloc(&sim.pool);
+            *cur = (struct process){.pid = arrival->pid,
+                                    .arrival_time = arrival->arrival_time,
+                                    .burst_time = arrival->burst_time,
+                                    .rem_time = arrival->burst_time,
+                                    .seq = src->next};
+            source_take(src);
+            sim.arrived++;
+
+            struct cpu *c = least_loaded(&sim);
+            cpu_enqueue(&sim, c, cur);
+            if (!c->running)
+                cpu_set_pending(&sim, c);
+            else if (policy->preempt && !c->preempt)
+            {
+                cpu_account(&sim, c);
+                if (policy->preempt(&c->s, c->running, cur))
+                {
+                    c->preempt = true;
+                    if (sim.now < c->switch_end)
+                    {
+                        heap_remove(&sim.running, c->running->heap_index);
+                        c->running->slice_end = c->switch_end;
+                        heap_push(&sim.running, c->running);
+                    }
+                    else
+                        cpu_set_pending(&sim, c);
+                }
+            }
+        }
+
+        // Let each CPU that became free, or whose process is preempted,
+        // dispatch a process
+        for (long i = 0; i < sim.npending; i++)
+        {
+            struct cpu *c = &sim.cpu[sim.pending[i]];
+            c->pending = false;
+            if (c->preempt)
+            {
+                heap_remove(&sim.running, c->running->heap_index);
+                cpu_stop(&sim, c);
+                c->preempt = false;
+            }
+            if (!c->running)
+                cpu_dispatch(&sim, c);
+        }
+        sim.npending = 0;
+
+        // Advance to the next arrival or slice end
+        long next = LONG_MAX;
+        if ((arrival = source_peek(src)))
+            next = arrival->arrival_time;
+        if (sim.running.count != 0 && sim.running.proc[0]->slice_end < next)
+            next = sim.running.proc[0]->slice_end;
+        sim.now = next;
+    }
+
+    for (long i = 0; i < config->ncpus; i++)
+        policy->destroy(&sim.cpu[i].s);
+    if (sim.window_wait && !src->unsorted)
+        report(&sim, sim.stats.end_time);
+    free(sim.window_wait);
+    free(sim.window_response);
+    pool_destroy(&sim.pool);
+    free(sim.running.proc);
+    free(sim.pending);
+    free(sim.cpu);
+    /* End of "Your code here" */
+
+    return sim.stats;
+}
+
+static void
+free_stats(struct schedule_stats *stats)
+{
+    free(stats->cpu);
+    free(stats->wait);
+    free(stats->response);
+    free(stats->turnaround);
+}
+
+/* Parse ARG, a comma-separated list whose items are quantum lengths,
+   "median", or ranges LOW..HIGH of quantum lengths, into a newly
+   allocated vector in which -1 stands for "median".  Store the vector's
+   length into *NQUANTA.  Report an error and exit on failure.  */
+static long *
+parse_quanta(char const *arg, long *nquanta)
+{
+    long *quanta = NULL;
+    long n = 0, alloc = 0;
+
+    for (char const *item = arg;; item++)
+    {
+        char const *item_end = item + strcspn(item, ",");
+        long low, high;
+
+        if (item_end - item == 6 && memcmp(item, "median", 6) == 0)
+            low = high = -1;
+        else
+        {
+            char const *dots = strstr(item, "..");
+            if (dots && item_end < dots)
+                dots = NULL;
+            char const *d = item;
+            low = high = next_int(&d, dots ? dots : item_end);
+            if (dots)
+            {
+                d = dots + 2;
+                high = next_int(&d, item_end);
+            }
+            if (high < low)
+            {
+                fprintf(stderr, "empty quantum range\n");
+                exit(1);
+            }
+        }
+
+        for (long q = low;; q++)
+        {
+            if (n == alloc)
+            {
+                size_t size;
+                if (ckd_mul(&alloc, alloc + 1, 2)
+                    || ckd_mul(&size, alloc, sizeof *quanta))
+                {
+                    fprintf(stderr, "too many quantum lengths\n");
+                    exit(1);
+                }
+                quanta = realloc(quanta, size);
+                if (!quanta)
+                {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            quanta[n++] = q;
+            if (q == high)
+                break;
+        }
+
+        item = item_end;
+        if (!*item)
+            break;
+    }
+
+    *nquanta = n;
+    return quanta;
+}
+
+/* A sweep over several quantum lengths.  A pool of threads simulates
+   them, each thread repeatedly claiming the next quantum not yet taken
+   and storing the result into the corresponding element of STATS.  */
+struct sweep
+{
+    struct process_set const *ps;
+    struct sim_config const *config;
+    long const *quanta;
+    long nquanta;
+    struct schedule_stats *stats;
+    atomic_long next;
+};
+
+static void *
+sweep_worker(void *arg)
+{
+    struct sweep *sweep = arg;
+    struct sim_config config = *sweep->config;
+
+    for (long i; (i = atomic_fetch_add(&sweep->next, 1)) < sweep->nquanta;)
+    {
+        struct arrival_source src = {.nprocesses = sweep->ps->nprocesses,
+                                     .ps = sweep->ps};
+        config.quantum_length = sweep->quanta[i];
+        sweep->stats[i] = simulate(&src, &config);
+    }
+    return NULL;
+}
+
+/* Simulate CONFIG with each of the NQUANTA quantum lengths in QUANTA on
+   PS, using up to one thread per online CPU, and return a newly
+   allocated vector of the results.  Report an error and exit on
+   failure.  */
+static struct schedule_stats *
+run_sweep(struct process_set const *ps, struct sim_config const *config,
+          long const *quanta, long nquanta)
+{
+    struct sweep sweep = {ps, config, quanta, nquanta, NULL, 0};
+    sweep.stats = malloc(nquanta * sizeof *sweep.stats);
+    if (!sweep.stats)
+    {
+        perror("malloc");
+        exit(1);
+    }
+
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nquanta < nthreads)
+        nthreads = nquanta;
+
+    pthread_t threads[nthreads];
+    for (long i = 0; i < nthreads; i++)
+    {
+        int err = pthread_create(&threads[i], NULL, sweep_worker, &sweep);
+        if (err != 0)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    for (long i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    return sweep.stats;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sim_config config = {&policies[0], 0, 1, 1, false, NULL, NULL, 0};
+    bool show_cpus = false;
+    char const *csv_name = NULL;
+    char const *trace_name = NULL;
+    char const csv_header[] = "pid,arrival_time,burst_time,start_time,end_time,"
+                              "wait_time,response_time,turnaround_time,cpu\n";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:i:o:p:Ps:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            config.ncpus = next_int_from_c_str(optarg);
+            if (config.ncpus == 0)
+            {
+                fprintf(stderr, "%s: zero CPUs\n", argv[0]);
+                return 1;
+            }
+            if (config.ncpus > INT_MAX)
+            {
+                fprintf(stderr, "%s: too many CPUs\n", argv[0]);
+                return 1;
+            }
+            show_cpus = true;
+            break;
+        case 'i':
+            config.report_interval = next_int_from_c_str(optarg);
+            if (config.report_interval == 0)
+            {
+                fprintf(stderr, "%s: zero report interval\n", argv[0]);
+                return 1;
+            }
+            break;
+        case 'o':
+            csv_name = optarg;
+            break;
+        case 'P':
+            config.percentiles = true;
+            break;
+        case 'p':
+            config.policy = find_policy(optarg);
+            if (!config.policy)
+            {
+                fprintf(stderr, "%s: unknown policy '%s' (expected rr, srtf, mlfq or cfs)\n",
+                        argv[0], optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            config.switch_cost = next_int_from_c_str(optarg);
+            break;
+        case 't':
+            trace_name = optarg;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (argc - optind != 2)
+    {
+    usage:
+        fprintf(stderr, "%s: usage: %s [-p policy] [-c ncpus] [-s switch_cost] [-P] [-o csv_file] [-t trace_file] [-i interval] file quantum\n",
+                argv[0], argv[0]);
+        return 1;
+    }
+
+    char const *filename = argv[optind];
+    char const *quantum_arg = argv[optind + 1];
+
+    // A list or range of quantum lengths asks for a sweep over all of them
+    bool sweep = strchr(quantum_arg, ',') || strstr(quantum_arg, "..");
+    long nquanta;
+    long *quanta = parse_quanta(quantum_arg, &nquanta);
+    for (long i = 0; i < nquanta; i++)
+    {
+        if (quanta[i] == 0)
+        {
+            fprintf(stderr, "%s: zero quantum length\n", argv[0]);
+            return 1;
+        }
+        if (quanta[i] == -1 && config.policy != &policies[0])
+        {
+            fprintf(stderr, "%s: median quantum requires the rr policy\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bool feed = strcmp(filename, "-") == 0;
+    if (sweep && (feed || config.report_interval))
+    {
+        fprintf(stderr, "%s: a sweep cannot read standard input or report rolling metrics\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (csv_name)
+    {
+        if (sweep)
+        {
+            fprintf(stderr, "%s: per-process output requires a single quantum length\n",
+                    argv[0]);
+            return 1;
+        }
+        config.csv = fopen(csv_name, "w");
+        if (!config.csv)
+        {
+            perror(csv_name);
+            return 1;
+        }
+        fputs(csv_header, config.csv);
+    }
+
+    if (trace_name)
+    {
+        if (sweep)
+        {
+            fprintf(stderr, "%s: tracing requires a single quantum length\n", argv[0]);
+            return 1;
+        }
+        config.trace = trace_open(trace_name, config.ncpus);
+    }
+
+    struct process_reader reader;
+    reader_open(&reader, filename);
+    long nprocesses = reader.nprocesses;
+
+    // A single simulation streams the file, which only needs sorting if
+    // it does not list processes in order of arrival; a sweep reads and
+    // sorts it once for all its simulations to share
+    struct process_set ps = {0};
+    struct schedule_stats *stats;
+    if (!sweep)
+    {
+        stats = malloc(sizeof *stats);
+        if (!stats)
+        {
+            perror("malloc");
+            exit(1);
+        }
+        // A streamed file found to be unsorted is simulated again, which
+        // means starting the output over; output that cannot be, such as
+        // a pipe, needs the file sorted before the one simulation instead
+        bool presort = !feed && ((config.trace && !is_regular_file(config.trace->fd))
+                                 || (config.csv && !is_regular_file(fileno(config.csv))));
+        struct arrival_source src = {.nprocesses = nprocesses, .reader = &reader};
+        if (presort)
+        {
+            ps = init_processes(&reader);
+            sort_by_arrival(&ps);
+            src = (struct arrival_source){.nprocesses = nprocesses, .ps = &ps};
+        }
+        config.quantum_length = quanta[0];
+        stats[0] = simulate(&src, &config);
+
+        // Standard input cannot be read again, and rolling reports
+        // cannot be taken back
+        if (src.unsorted && (feed || config.report_interval))
+        {
+            fprintf(stderr, "%s: processes must be listed in order of arrival\n", argv[0]);
+            return 1;
+        }
+        if (src.unsorted)
+        {
+            // Start the per-process output and the trace over too
+            if (config.csv
+                && (fflush(config.csv) < 0 || ftruncate(fileno(config.csv), 0) < 0))
+            {
+                perror(csv_name);
+                return 1;
+            }
+            if (config.csv)
+            {
+                rewind(config.csv);
+                fputs(csv_header, config.csv);
+            }
+            if (config.trace)
+                trace_restart(config.trace);
+            free_stats(&stats[0]);
+            reader_rewind(&reader);
+            ps = init_processes(&reader);
+            sort_by_arrival(&ps);
+            src = (struct arrival_source){.nprocesses = nprocesses, .ps = &ps};
+            stats[0] = simulate(&src, &config);
+        }
+
+        nprocesses = src.next;
+        if (nprocesses == 0)
+        {
+            fprintf(stderr, "no processes\n");
+            return 1;
+        }
+    }
+    else
+    {
+        ps = init_processes(&reader);
+        sort_by_arrival(&ps);
+        stats = run_sweep(&ps, &config, quanta, nquanta);
+    }
+    reader_close(&reader);
+
+    // print all process statistics
+
+    if (!sweep)
+    {
+        printf("Average wait time: %.2f\n",
+               stats[0].total_wait_time / (double)nprocesses);
+        printf("Average response time: %.2f\n",
+               stats[0].total_response_time / (double)nprocesses);
+
+        if (show_cpus)
+        {
+            printf("Migrations: %ld\n", stats[0].migrations);
+            printf("%4s  %11s  %10s  %6s\n",
+                   "CPU", "Utilization", "Dispatches", "Steals");
+            for (long i = 0; i < config.ncpus; i++)
+            {
+                struct cpu_stats const *cs = &stats[0].cpu[i];
+                printf("%4ld  %10.2f%%  %10ld  %6ld\n", i,
+                       (stats[0].end_time == 0 ? 0
+                        : 100.0 * cs->busy_time / stats[0].end_time),
+                       cs->dispatches, cs->steals);
+            }
+        }
+
+        if (config.percentiles)
+        {
+            struct
+            {
+                char const *name;
+                struct sketch const *sk;
+            } const rows[] = {{"Wait", stats[0].wait},
+                              {"Response", stats[0].response},
+                              {"Turnaround", stats[0].turnaround}};
+
+            printf("%-10s  %10s  %10s  %10s  %10s\n", "", "p50", "p90", "p99", "max");
+            for (size_t i = 0; i < sizeof rows / sizeof *rows; i++)
+                printf("%-10s  %10ld  %10ld  %10ld  %10ld\n", rows[i].name,
+                       sketch_quantile(rows[i].sk, 0.5),
+                       sketch_quantile(rows[i].sk, 0.9),
+                       sketch_quantile(rows[i].sk, 0.99), rows[i].sk->max);
+        }
+    }
+    else
+    {
+        printf("%8s  %18s  %22s", "Quantum", "Average wait time", "Average response time");
+        if (config.percentiles)
+            printf("  %13s  %17s", "p99 wait time", "p99 response time");
+        printf("\n");
+        for (long i = 0; i < nquanta; i++)
+        {
+            if (quanta[i] == -1)
+                printf("%8s", "median");
+            else
+                printf("%8ld", quanta[i]);
+            printf("  %18.2f  %22.2f",
+                   stats[i].total_wait_time / (double)nprocesses,
+                   stats[i].total_response_time / (double)nprocesses);
+            if (config.percentiles)
+                printf("  %13ld  %17ld", sketch_quantile(stats[i].wait, 0.99),
+                       sketch_quantile(stats[i].response, 0.99));
+            printf("\n");
+        }
+    }
+
+    if (config.trace)
+        trace_close(config.trace);
+    if (config.csv && fclose(config.csv) != 0)
+    {
+        perror(csv_name);
+        return 1;
+    }
 
     if (fflush(stdout) < 0 || ferror(stdout))
     {
@@ -401,6 +2338,10 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    free(ps.process);
+    for (long i = 0; i < nquanta; i++)
+        free_stats(&stats[i]);
+    free(stats);
+    free(quanta);
+    free_processes(&ps);
     return 0;
 }
@@ -0,0 +1,168 @@
+import csv
+import os
+import subprocess
+import tempfile
+import unittest
+
+class TestLab2(unittest.TestCase):
+
+    def _make():
+        result = subprocess.run(['make'], capture_output=True, text=True)
+        return result
+
+    def _make_clean():
+        result = subprocess.run(['make', 'clean'],
+                                capture_output=True, text=True)
+        return result
+
+    @classmethod
+    def setUpClass(cls):
+        cls.make = cls._make().returncode == 0
+
+    @classmethod
+    def tearDownClass(cls):
+        cls._make_clean()
+
+    def _rr(self, *args, **kwargs):
+        result = subprocess.run(['./rr', *args], capture_output=True,
+                                text=True, **kwargs)
+        self.assertEqual(result.returncode, 0, msg=result.stderr)
+        return result.stdout
+
+    def _averages(self, output):
+        """Return the average wait and response times that rr printed"""
+        lines = output.splitlines()
+        return (next(l for l in lines if l.startswith('Average wait time:')),
+                next(l for l in lines if l.startswith('Average response time:')))
+
+    def _waits(self, processes, *args):
+        """Return the wait time of each process, by pid, when rr simulates
+        the (pid, arrival, burst) tuples PROCESSES with ARGS"""
+        with tempfile.NamedTemporaryFile('w', suffix='.txt') as f:
+            f.write(f'{len(processes)}\n')
+            for p in processes:
+                f.write('{}, {}, {}\n'.format(*p))
+            f.flush()
+            result = subprocess.run(['./rr', '-o', '/dev/stdout', *args, f.name, '1'],
+                                    capture_output=True, text=True)
+        self.assertEqual(result.returncode, 0, msg=result.stderr)
+        rows = csv.DictReader(line for line in result.stdout.splitlines()
+                              if not line.startswith('Average'))
+        return {int(row['pid']): int(row['wait_time']) for row in rows}
+
+    def test_srtf_preempt_at_dispatch(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        # P3 arrives just as P2 is dispatched, after the switch from P1
+        waits = self._waits([(1, 0, 5), (2, 0, 100), (3, 6, 1)], '-p', 'srtf')
+        self.assertEqual(waits[3], 1, msg='P3 should preempt P2 as it starts')
+
+    def test_srtf_preempt_during_switch(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        # P3 arrives while P2 is being switched in, from 5 to 8
+        waits = self._waits([(1, 0, 5), (2, 0, 100), (3, 6, 1)],
+                            '-p', 'srtf', '-s', '3')
+        self.assertEqual(waits[3], 5, msg='P3 should preempt P2 when the switch ends')
+
+    def test_mlfq_preempt_during_switch(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        # P1, down a level, is being switched back in from 5 to 8 when P3
+        # arrives
+        waits = self._waits([(1, 0, 3), (2, 0, 100), (3, 7, 1)],
+                            '-p', 'mlfq', '-s', '3')
+        self.assertEqual(waits[3], 4, msg='P3 should preempt P1 when the switch ends')
+
+    def test_processes(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        self.assertEqual(self._averages(self._rr('processes.txt', '30')),
+                         ('Average wait time: 82.75',
+                          'Average response time: 37.00'))
+        self.assertEqual(self._averages(self._rr('processes.txt', 'median')),
+                         ('Average wait time: 81.75',
+                          'Average response time: 13.75'))
+
+    def test_sweep(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        lines = self._rr('processes.txt', '10,30,median').splitlines()
+        self.assertEqual(lines[0].split(),
+                         'Quantum Average wait time Average response time'.split())
+        self.assertEqual(len(lines), 4)
+        for line, quantum in zip(lines[1:], ['10', '30', 'median']):
+            wait, response = self._averages(self._rr('processes.txt', quantum))
+            self.assertEqual(line.split(),
+                             [quantum, wait.split()[-1], response.split()[-1]],
+                             msg=f'quantum {quantum}')
+
+    def test_one_cpu(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        for policy in ['rr', 'srtf', 'mlfq', 'cfs']:
+            self.assertEqual(
+                self._averages(self._rr('-p', policy, '-c', '1', 'processes.txt', '30')),
+                self._averages(self._rr('-p', policy, 'processes.txt', '30')),
+                msg=policy)
+
+    def test_csv(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        with tempfile.TemporaryDirectory() as d:
+            path = os.path.join(d, 'times.csv')
+            output = self._rr('-P', '-o', path, 'processes.txt', '30')
+            with open(path) as f:
+                rows = list(csv.DictReader(f))
+        self.assertEqual([int(row['pid']) for row in rows], [3, 2, 1, 4])
+        for row in rows:
+            t = {k: int(v) for k, v in row.items()}
+            self.assertEqual(t['turnaround_time'], t['end_time'] - t['arrival_time'])
+            self.assertEqual(t['wait_time'], t['turnaround_time'] - t['burst_time'])
+            self.assertEqual(t['response_time'], t['start_time'] - t['arrival_time'])
+            self.assertEqual(t['cpu'], 0)
+        self.assertEqual([row['wait_time'] for row in rows], ['63', '95', '86', '87'])
+        self.assertEqual([row['response_time'] for row in rows], ['63', '21', '0', '64'])
+
+        # With 4 processes, the 50th percentile is the second smallest time
+        # and the rest are the largest
+        lines = output.splitlines()
+        self.assertEqual(lines[2].split(), ['p50', 'p90', 'p99', 'max'])
+        self.assertEqual(lines[3].split(), ['Wait', '86', '95', '95', '95'])
+        self.assertEqual(lines[4].split(), ['Response', '21', '64', '64', '64'])
+        self.assertEqual(lines[5].split(), ['Turnaround', '127', '156', '156', '156'])
+
+    def test_trace(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        with tempfile.TemporaryDirectory() as d:
+            trace = os.path.join(d, 'trace.bin')
+            times = os.path.join(d, 'times.csv')
+            self._rr('-t', trace, '-o', times, 'processes.txt', '30')
+            result = subprocess.run(['./rr-trace', trace],
+                                    capture_output=True, text=True)
+            with open(times) as f:
+                rows = list(csv.DictReader(f))
+        self.assertEqual(result.returncode, 0, msg=result.stderr)
+
+        # Every process is first dispatched at its start time and completes
+        # at its end time
+        events = [line.split() for line in result.stdout.splitlines()]
+        for row in rows:
+            pid = row['pid']
+            dispatches = [e[0] for e in events if e[3] == 'dispatch' and e[5] == pid]
+            completions = [e[0] for e in events if e[3] == 'complete' and e[5] == pid]
+            self.assertEqual(dispatches[0], row['start_time'] + ':', msg=f'P{pid}')
+            self.assertEqual(completions, [row['end_time'] + ':'], msg=f'P{pid}')
+        self.assertEqual(events[-1], ['177:', 'cpu', '0', 'complete', 'pid', '4'])
+
+    def test_feed(self):
+        self.assertTrue(self.make, msg='make failed')
+
+        with open('processes.txt') as f:
+            feed = ''.join(f.readlines()[1:])
+        for policy in ['rr', 'srtf']:
+            self.assertEqual(
+                self._averages(self._rr('-p', policy, '-', '30', input=feed)),
+                self._averages(self._rr('-p', policy, 'processes.txt', '30')),
+                msg=policy)
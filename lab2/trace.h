@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+/* A schedule trace, as written by rr -t, is a trace_header followed by
+   fixed-width trace_records, all in the byte order of the machine that
+   wrote it.  The records of each CPU are in time order.  */
+
+#define TRACE_MAGIC "RRTRACE"
+#define TRACE_VERSION 1
+
+struct trace_header
+{
+    char magic[8];   /* TRACE_MAGIC, null-terminated */
+    uint32_t version;
+    uint32_t ncpus;
+};
+
+enum trace_kind
+{
+    TRACE_SWITCH,   /* A context switch to PID starts; ARG is its cost */
+    TRACE_DISPATCH, /* PID starts running; ARG is the most it may run */
+    TRACE_EXPIRE,   /* PID used up its slice; ARG is its remaining time */
+    TRACE_PREEMPT,  /* An arrival preempted PID; ARG is its remaining time */
+    TRACE_COMPLETE, /* PID completed */
+};
+
+struct trace_record
+{
+    int64_t time;
+    int64_t pid;
+    int64_t arg;
+    int32_t cpu;
+    uint32_t kind; /* An enum trace_kind */
+};
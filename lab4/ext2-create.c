@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -18,6 +19,7 @@ typedef int32_t i32;
 #define BLOCK_SIZE 1024
 #define BLOCK_OFFSET(i) (i * BLOCK_SIZE)
 #define NUM_BLOCKS 1024
+#define IMAGE_SIZE (NUM_BLOCKS * BLOCK_SIZE)
 #define NUM_INODES 128
 
 #define LOST_AND_FOUND_INO 11
@@ -181,14 +183,15 @@ struct ext2_dir_entry
 		}                                     \
 	} while (0)
 
-#define dir_entry_write(entry, fd)           \
-	do                                       \
-	{                                        \
-		size_t size = entry.rec_len;         \
-		if (write(fd, &entry, size) != size) \
-		{                                    \
-			errno_exit("write");             \
-		}                                    \
+/* Only the header and name are copied: the rest of the record is already
+   zero in the image, and the filler at the end of a block is longer than
+   struct ext2_dir_entry */
+#define dir_entry_write(entry, dst)                                           \
+	do                                                                        \
+	{                                                                         \
+		size_t size = offsetof(struct ext2_dir_entry, name) + entry.name_len; \
+		memcpy(dst, &entry, size);                                            \
+		dst += entry.rec_len;                                                 \
 	} while (0)
 
 u32 get_current_time()
@@ -201,13 +204,9 @@ u32 get_current_time()
 	return t;
 }
 
-void write_superblock(int fd)
+void write_superblock(u8 *image)
 {
-	off_t off = lseek(fd, BLOCK_OFFSET(1), SEEK_SET);
-	if (off == -1)
-	{
-		errno_exit("lseek");
-	}
+	u8 *dst = image + BLOCK_OFFSET(1);
 
 	u32 current_time = get_current_time();
 
@@ -262,20 +261,12 @@ void write_superblock(int fd)
 
 	memcpy(&superblock.s_volume_name, "cs111-base", 10);
 
-	ssize_t size = sizeof(superblock);
-	if (write(fd, &superblock, size) != size)
-	{
-		errno_exit("write");
-	}
+	memcpy(dst, &superblock, sizeof(superblock));
 }
 
-void write_block_group_descriptor_table(int fd)
+void write_block_group_descriptor_table(u8 *image)
 {
-	off_t off = lseek(fd, BLOCK_OFFSET(BLOCK_GROUP_DESCRIPTOR_BLOCKNO), SEEK_SET);
-	if (off == -1)
-	{
-		errno_exit("lseek");
-	}
+	u8 *dst = image + BLOCK_OFFSET(BLOCK_GROUP_DESCRIPTOR_BLOCKNO);
 
 	struct ext2_block_group_descriptor block_group_descriptor = {0};
 
@@ -288,20 +279,12 @@ void write_block_group_descriptor_table(int fd)
 	block_group_descriptor.bg_free_inodes_count = NUM_FREE_INODES;
 	block_group_descriptor.bg_used_dirs_count = 2;
 
-	ssize_t size = sizeof(block_group_descriptor);
-	if (write(fd, &block_group_descriptor, size) != size)
-	{
-		errno_exit("write");
-	}
+	memcpy(dst, &block_group_descriptor, sizeof(block_group_descriptor));
 }
 
-void write_block_bitmap(int fd)
+void write_block_bitmap(u8 *image)
 {
-	off_t off = lseek(fd, BLOCK_OFFSET(BLOCK_BITMAP_BLOCKNO), SEEK_SET);
-	if (off == -1)
-	{
-		errno_exit("lseek");
-	}
+	u8 *dst = image + BLOCK_OFFSET(BLOCK_BITMAP_BLOCKNO);
 
 	// TODO It's all yours
 	u8 map_value[BLOCK_SIZE];
@@ -330,19 +313,12 @@ void write_block_bitmap(int fd)
 		}
 	}
 
-	if (write(fd, map_value, BLOCK_SIZE) != BLOCK_SIZE)
-	{
-		errno_exit("write");
-	}
+	memcpy(dst, map_value, BLOCK_SIZE);
 }
 
-void write_inode_bitmap(int fd)
+void write_inode_bitmap(u8 *image)
 {
-	off_t off = lseek(fd, BLOCK_OFFSET(INODE_BITMAP_BLOCKNO), SEEK_SET);
-	if (off == -1)
-	{
-		errno_exit("lseek");
-	}
+	u8 *dst = image + BLOCK_OFFSET(INODE_BITMAP_BLOCKNO);
 
 	// TODO It's all yours
 	u8 map_value[BLOCK_SIZE];
@@ -368,29 +344,16 @@ void write_inode_bitmap(int fd)
 		}
 	}
 
-	if (write(fd, map_value, BLOCK_SIZE) != BLOCK_SIZE)
-	{
-		errno_exit("write");
-	}
+	memcpy(dst, map_value, BLOCK_SIZE);
 }
 
-void write_inode(int fd, u32 index, struct ext2_inode *inode)
+void write_inode(u8 *image, u32 index, struct ext2_inode *inode)
 {
-	off_t off = BLOCK_OFFSET(INODE_TABLE_BLOCKNO) + (index - 1) * sizeof(struct ext2_inode);
-	off = lseek(fd, off, SEEK_SET);
-	if (off == -1)
-	{
-		errno_exit("lseek");
-	}
-
-	ssize_t size = sizeof(struct ext2_inode);
-	if (write(fd, inode, size) != size)
-	{
-		errno_exit("write");
-	}
+	u8 *dst = image + BLOCK_OFFSET(INODE_TABLE_BLOCKNO) + (index - 1) * sizeof(struct ext2_inode);
+	memcpy(dst, inode, sizeof(struct ext2_inode));
 }
 
-void write_inode_table(int fd)
+void write_inode_table(u8 *image)
 {
 	u32 current_time = get_current_time();
 
@@ -406,7 +369,7 @@ void write_inode_table(int fd)
 	lost_and_found_inode.i_links_count = 2;
 	lost_and_found_inode.i_blocks = 2; /* These are oddly 512 blocks */
 	lost_and_found_inode.i_block[0] = LOST_AND_FOUND_DIR_BLOCKNO;
-	write_inode(fd, LOST_AND_FOUND_INO, &lost_and_found_inode);
+	write_inode(image, LOST_AND_FOUND_INO, &lost_and_found_inode);
 
 	// TODO It's all yours
 	// TODO finish the inode entries for the other files
@@ -422,7 +385,7 @@ void write_inode_table(int fd)
 	root.i_links_count = 3;
 	root.i_blocks = 2; /* These are oddly 512 blocks */
 	root.i_block[0] = ROOT_DIR_BLOCKNO;
-	write_inode(fd, EXT2_ROOT_INO, &root);
+	write_inode(image, EXT2_ROOT_INO, &root);
 
 	struct ext2_inode hello_world_file = {0};
 	hello_world_file.i_mode = EXT2_S_IFREG | EXT2_S_IRUSR | EXT2_S_IWUSR | EXT2_S_IRGRP | EXT2_S_IROTH;
@@ -436,7 +399,7 @@ void write_inode_table(int fd)
 	hello_world_file.i_links_count = 1;
 	hello_world_file.i_blocks = 2; /* These are oddly 512 blocks */
 	hello_world_file.i_block[0] = HELLO_WORLD_FILE_BLOCKNO;
-	write_inode(fd, HELLO_WORLD_INO, &hello_world_file);
+	write_inode(image, HELLO_WORLD_INO, &hello_world_file);
 
 	struct ext2_inode hello_world_symlink = {0};
 	hello_world_symlink.i_mode = EXT2_S_IFLNK | EXT2_S_IRUSR | EXT2_S_IWUSR | EXT2_S_IRGRP | EXT2_S_IROTH;
@@ -450,127 +413,118 @@ void write_inode_table(int fd)
 	hello_world_symlink.i_links_count = 1;
 	hello_world_symlink.i_blocks = 0; /* These are oddly 512 blocks */
 	memcpy(hello_world_symlink.i_block, "hello-world", strlen("hello-world"));
-	write_inode(fd, HELLO_INO, &hello_world_symlink);
+	write_inode(image, HELLO_INO, &hello_world_symlink);
 }
 
-void write_root_dir_block(int fd)
+void write_root_dir_block(u8 *image)
 {
 	// TODO It's all yours
-	off_t off = BLOCK_OFFSET(ROOT_DIR_BLOCKNO);
-	off = lseek(fd, off, SEEK_SET);
-	if (off == -1)
-	{
-		errno_exit("lseek");
-	}
+	u8 *dst = image + BLOCK_OFFSET(ROOT_DIR_BLOCKNO);
 
 	ssize_t bytes_remaining = BLOCK_SIZE;
 
 	struct ext2_dir_entry current_entry = {0};
 	dir_entry_set(current_entry, EXT2_ROOT_INO, ".");
-	dir_entry_write(current_entry, fd);
+	dir_entry_write(current_entry, dst);
 
 	bytes_remaining -= current_entry.rec_len;
 
 	struct ext2_dir_entry parent_entry = {0};
 	dir_entry_set(parent_entry, EXT2_ROOT_INO, "..");
-	dir_entry_write(parent_entry, fd);
+	dir_entry_write(parent_entry, dst);
 
 	bytes_remaining -= parent_entry.rec_len;
 
 	struct ext2_dir_entry lost_and_found = {0};
 	dir_entry_set(lost_and_found, LOST_AND_FOUND_INO, "lost+found");
-	dir_entry_write(lost_and_found, fd);
+	dir_entry_write(lost_and_found, dst);
 
 	bytes_remaining -= lost_and_found.rec_len;
 
 	struct ext2_dir_entry hello_world_file = {0};
 	dir_entry_set(hello_world_file, HELLO_WORLD_INO, "hello-world");
-	dir_entry_write(hello_world_file, fd);
+	dir_entry_write(hello_world_file, dst);
 
 	bytes_remaining -= hello_world_file.rec_len;
 
 	struct ext2_dir_entry hello_world_symlink = {0};
 	dir_entry_set(hello_world_symlink, HELLO_INO, "hello");
-	dir_entry_write(hello_world_symlink, fd);
+	dir_entry_write(hello_world_symlink, dst);
 
 	bytes_remaining -= hello_world_symlink.rec_len;
 
 	struct ext2_dir_entry fill_entry = {0};
 	fill_entry.rec_len = bytes_remaining;
-	dir_entry_write(fill_entry, fd);
+	dir_entry_write(fill_entry, dst);
 }
 
-void write_lost_and_found_dir_block(int fd)
+void write_lost_and_found_dir_block(u8 *image)
 {
-	off_t off = BLOCK_OFFSET(LOST_AND_FOUND_DIR_BLOCKNO);
-	off = lseek(fd, off, SEEK_SET);
-	if (off == -1)
-	{
-		errno_exit("lseek");
-	}
+	u8 *dst = image + BLOCK_OFFSET(LOST_AND_FOUND_DIR_BLOCKNO);
 
 	ssize_t bytes_remaining = BLOCK_SIZE;
 
 	struct ext2_dir_entry current_entry = {0};
 	dir_entry_set(current_entry, LOST_AND_FOUND_INO, ".");
-	dir_entry_write(current_entry, fd);
+	dir_entry_write(current_entry, dst);
 
 	bytes_remaining -= current_entry.rec_len;
 
 	struct ext2_dir_entry parent_entry = {0};
 	dir_entry_set(parent_entry, EXT2_ROOT_INO, "..");
-	dir_entry_write(parent_entry, fd);
+	dir_entry_write(parent_entry, dst);
 
 	bytes_remaining -= parent_entry.rec_len;
 
 	struct ext2_dir_entry fill_entry = {0};
 	fill_entry.rec_len = bytes_remaining;
-	dir_entry_write(fill_entry, fd);
+	dir_entry_write(fill_entry, dst);
 }
 
-void write_hello_world_file_block(int fd)
+void write_hello_world_file_block(u8 *image)
 {
 	// TODO It's all yours
-	off_t off = BLOCK_OFFSET(HELLO_WORLD_FILE_BLOCKNO);
-	off = lseek(fd, off, SEEK_SET);
-	if (off == -1)
-	{
-		errno_exit("lseek");
-	}
+	u8 *dst = image + BLOCK_OFFSET(HELLO_WORLD_FILE_BLOCKNO);
 
 	const char hello_world_str[] = "Hello world\n";
-	if (write(fd, hello_world_str, sizeof(hello_world_str)) != sizeof(hello_world_str))
-	{
-		errno_exit("write");
-	}
+	memcpy(dst, hello_world_str, sizeof(hello_world_str));
 }
 
 int main(int argc, char *argv[])
 {
-	int fd = open("cs111-base.img", O_CREAT | O_WRONLY, 0666);
+	/* The image is built in memory and written out all at once, so the
+	   number of system calls does not grow with its contents */
+	static u8 image[IMAGE_SIZE];
+
+	write_superblock(image);
+	write_block_group_descriptor_table(image);
+	write_block_bitmap(image);
+	write_inode_bitmap(image);
+	write_inode_table(image);
+	write_root_dir_block(image);
+	write_lost_and_found_dir_block(image);
+	write_hello_world_file_block(image);
+
+	int fd = open("cs111-base.img", O_CREAT | O_WRONLY | O_TRUNC, 0666);
 	if (fd == -1)
 	{
 		errno_exit("open");
 	}
 
-	if (ftruncate(fd, 0))
-	{
-		errno_exit("ftruncate");
-	}
-	if (ftruncate(fd, NUM_BLOCKS * BLOCK_SIZE))
+	for (size_t done = 0; done < IMAGE_SIZE;)
 	{
-		errno_exit("ftruncate");
+		ssize_t n = write(fd, image + done, IMAGE_SIZE - done);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			errno_exit("write");
+		}
+		done += n;
 	}
 
-	write_superblock(fd);
-	write_block_group_descriptor_table(fd);
-	write_block_bitmap(fd);
-	write_inode_bitmap(fd);
-	write_inode_table(fd);
-	write_root_dir_block(fd);
-	write_lost_and_found_dir_block(fd);
-	write_hello_world_file_block(fd);
-
 	if (close(fd))
 	{
 		errno_exit("close");